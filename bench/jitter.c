@@ -0,0 +1,208 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * jitter runs the dwell code of svkbd.c with dwelltime 800 on the layout
+ * it is linked with, the way run() drives it. Each motion event goes
+ * through motionnotify(), dwell() and present(). Between events, the
+ * poll() timeouts of dwelltimeout() are timer wakeups that run dwell()
+ * and present() too. The clock is simulated, and the X calls only
+ * count what would be drawn and sent. The pointer visits the plain keys
+ * in turn:
+ *
+ *   shaking  a head tracker at 100Hz, up to 6px around the key center,
+ *            2s on each key
+ *   resting  one event when the pointer reaches a key, then 2s still
+ *
+ * CPU time is for all of svkbd, the injector thread included.
+ */
+#include <time.h>
+
+static struct timespec clocknow; /* simulated */
+
+int
+fakeclock(clockid_t id, struct timespec *t) {
+	*t = clocknow;
+	return 0;
+}
+
+#define CONFIG "bench/jitter.h"
+#define main svkbdmain
+#define clock_gettime fakeclock
+#define XChangeKeyboardMapping sinkmapping
+#define XCopyArea sinkcopy
+#define XDrawRectangles sinkrects
+#define XDrawString sinkstring
+#define XFillRectangles sinkfill
+#define XFlush sinkflush
+#define XKeysymToKeycode sinkkeycode
+#define XmbDrawString sinkmbstring
+#define XSetForeground sinkforeground
+#define XSync sinksync
+#define XTestFakeKeyEvent sinkkey
+#define XTextWidth sinkwidth
+#include "../svkbd.c"
+#undef main
+#undef clock_gettime
+
+#define STAY            2000 /* ms on each key */
+
+static ulong fills = 0, boxes = 0, injected = 0;
+
+int
+sinkmapping(Display *dpy, int first, int per, KeySym *syms, int n) {
+	return 1;
+}
+
+int
+sinkcopy(Display *dpy, Drawable src, Drawable dst, GC gc, int sx, int sy,
+		uint w, uint h, int dx, int dy) {
+	return 1;
+}
+
+int
+sinkrects(Display *dpy, Drawable d, GC gc, XRectangle *r, int n) {
+	boxes++; /* one per drawbox() */
+	return 1;
+}
+
+int
+sinkstring(Display *dpy, Drawable d, GC gc, int x, int y, const char *s,
+		int len) {
+	return 1;
+}
+
+int
+sinkfill(Display *dpy, Drawable d, GC gc, XRectangle *r, int n) {
+	fills++;
+	return 1;
+}
+
+int
+sinkflush(Display *dpy) {
+	return 1;
+}
+
+KeyCode
+sinkkeycode(Display *dpy, KeySym keysym) {
+	injected++; /* by inject(), once per key event */
+	return 10;
+}
+
+void
+sinkmbstring(Display *dpy, Drawable d, XFontSet set, GC gc, int x, int y,
+		const char *s, int len) {
+}
+
+int
+sinkforeground(Display *dpy, GC gc, ulong pixel) {
+	return 1;
+}
+
+int
+sinksync(Display *dpy, Bool discard) {
+	return 1;
+}
+
+int
+sinkkey(Display *dpy, uint keycode, Bool press, ulong delay) {
+	return 1;
+}
+
+int
+sinkwidth(XFontStruct *font, const char *s, int len) {
+	return 0;
+}
+
+/* moves the simulated clock on by ms */
+static void
+advance(long ms) {
+	clocknow.tv_nsec += ms % 1000 * 1000000;
+	clocknow.tv_sec += ms / 1000 + clocknow.tv_nsec / 1000000000;
+	clocknow.tv_nsec %= 1000000000;
+}
+
+/* keys dwelling may press without leaving the keyboard */
+static Bool
+plain(int k) {
+	KeySym ks = keys[k].keysym;
+
+	return ks && !IsModifierKey(ks) && ks != XK_Multi_key
+		&& ks != XK_Cancel && ks != XK_SvkbdSymbols
+		&& ks != XK_SvkbdSteno;
+}
+
+static void
+simulate(const char *name, int every, int shake, int nvisits) {
+	XEvent ev = { .type = MotionNotify };
+	ulong events = 0, wakeups = 0, before = frames;
+	long t, gap, left;
+	double cpu = cputime();
+	int v, key = 0;
+
+	fills = boxes = injected = 0;
+	for(v = 0; v < nvisits; v++) {
+		do
+			key = (key + 1) % nkeys;
+		while(!plain(key));
+		for(left = STAY; left > 0; left -= every) {
+			ev.xmotion.x = kb->geom.x[key] + kb->geom.w[key] / 2;
+			ev.xmotion.y = kb->geom.y[key] + kb->geom.h[key] / 2;
+			if(shake) {
+				ev.xmotion.x += rand() % (2 * shake + 1)
+					- shake;
+				ev.xmotion.y += rand() % (2 * shake + 1)
+					- shake;
+			}
+			motionnotify(&ev);
+			dwell();
+			present();
+			events++;
+			/* the poll() timeouts until the next event */
+			for(gap = every; (t = dwelltimeout()) >= 0 && t < gap;
+					gap -= t) {
+				advance(t);
+				wakeups++;
+				dwell();
+				present();
+			}
+			advance(gap);
+		}
+	}
+	cpu = cputime() - cpu;
+	printf("%s: %lu events, %lu timer wakeups, %lu strips, "
+			"%lu key redraws, %lu frames, %lu presses in %ds\n",
+			name, events, wakeups, fills - boxes, boxes,
+			frames - before, injected / 2, nvisits * STAY / 1000);
+	printf("%s: %.0f ns CPU per event and wakeup, %.4f%% of one CPU\n",
+			name, cpu * 1e9 / (events + wakeups),
+			cpu * 100 / (nvisits * STAY / 1000.0));
+}
+
+int
+main(void) {
+	kb = kbds = ecalloc(1, sizeof(Kbd));
+	kb->dpy = kb->idpy = (Display *)&clocknow; /* never looked into */
+	kb->ww = 800;
+	kb->wh = 300;
+	kb->isvisible = True;
+	kb->composekey = -1;
+	kb->dwellkey = -1;
+	initlayout();
+	kb->geom.x = ecalloc(4 * nkeys, sizeof(int));
+	kb->geom.y = kb->geom.x + nkeys;
+	kb->geom.w = kb->geom.y + nkeys;
+	kb->geom.h = kb->geom.w + nkeys;
+	kb->pressed = ecalloc(2 * nwords, sizeof(uint));
+	kb->highlighted = kb->pressed + nwords;
+	updatekeys();
+	initinjector();
+	clocknow.tv_sec = 1;
+
+	srand(3);
+	printf("%u keys, dwelltime %ums, %d strips\n", nkeys, dwelltime,
+			DWELLSTEPS);
+	simulate("shaking", 10, 6, 5000);
+	simulate("resting", STAY, 0, 5000);
+	enqueue(NULL, 0, 0, False);
+	pthread_join(injectthread, NULL);
+	return 0;
+}
@@ -0,0 +1,5 @@
+/* config.h with dwelling on, for bench/jitter.c */
+#define dwelltime configdwelltime
+#include "../config.h"
+#undef dwelltime
+static const uint dwelltime = 800;
@@ -0,0 +1,240 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * scan times the key scans of the event loop on a synthetic layout of
+ * 2080 keys, once with the old Key that held geometry and state for
+ * every key and once with the geometry arrays and bitsets svkbd.c uses
+ * now. Nothing is drawn, the motion figures are the bookkeeping only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include "../svkbd.h"
+
+#define ROWS            32
+#define COLS            64
+#define NKEYS           (ROWS * (COLS + 1)) /* a separator per row */
+#define KEYSIZE         20
+#define NWORDS          ((NKEYS + 31) / 32)
+#define NMOTIONS        200000
+
+#define ISSET(s, i)     ((s)[(i) / 32] >> (i) % 32 & 1)
+#define SETBIT(s, i)    ((s)[(i) / 32] |= 1U << (i) % 32)
+#define CLRBIT(s, i)    ((s)[(i) / 32] &= ~(1U << (i) % 32))
+#define LOWBIT(w)       (ffs(w) - 1)
+
+typedef struct {
+	char *label;
+	KeySym keysym;
+	uint width;
+	int x, y, w, h;
+	Bool pressed;
+	Bool highlighted;
+} OldKey;
+
+static long newfind(int x, int y);
+static long newfirst(int x, int y);
+static long newmods(int x, int y);
+static long newmotion(int x, int y);
+static long oldfind(int x, int y);
+static long oldfirst(int x, int y);
+static long oldmods(int x, int y);
+static long oldmotion(int x, int y);
+static void run(const char *name, long (*f)(int, int));
+
+static OldKey old[NKEYS];
+static Key layout[NKEYS];
+static int gx[NKEYS], gy[NKEYS], gw[NKEYS], gh[NKEYS];
+static uint pressed[NWORDS], highlighted[NWORDS], modkeys[NWORDS];
+static int px[NMOTIONS], py[NMOTIONS];
+
+long
+oldfind(int x, int y) {
+	int i;
+
+	for(i = 0; i < NKEYS; i++) {
+		if(old[i].keysym && x > old[i].x && x < old[i].x + old[i].w
+				&& y > old[i].y && y < old[i].y + old[i].h)
+			return i;
+	}
+	return -1;
+}
+
+long
+newfind(int x, int y) {
+	int i;
+
+	for(i = 0; i < NKEYS; i++) {
+		if(y > gy[i] && y < gy[i] + gh[i]
+				&& x > gx[i] && x < gx[i] + gw[i])
+			return i;
+	}
+	return -1;
+}
+
+/* motionnotify(), counting the keys that would be redrawn */
+long
+oldmotion(int x, int y) {
+	long n = 0;
+	int i;
+
+	for(i = 0; i < NKEYS; i++) {
+		if(old[i].keysym && x > old[i].x && x < old[i].x + old[i].w
+				&& y > old[i].y && y < old[i].y + old[i].h) {
+			if(!old[i].highlighted) {
+				old[i].highlighted = True;
+				n++;
+			}
+			continue;
+		}
+		if(!IsModifierKey(old[i].keysym) && old[i].pressed)
+			n++;
+		if(old[i].highlighted) {
+			old[i].highlighted = False;
+			n++;
+		}
+	}
+	return n;
+}
+
+long
+newmotion(int x, int y) {
+	long n = 0;
+	int i = newfind(x, y), j, k;
+	uint w;
+
+	for(j = 0; j < NWORDS; j++) {
+		for(w = pressed[j] & ~modkeys[j]; w; w &= w - 1) {
+			if((k = j * 32 + LOWBIT(w)) != i)
+				n++;
+		}
+		for(w = highlighted[j]; w; w &= w - 1) {
+			if((k = j * 32 + LOWBIT(w)) != i) {
+				CLRBIT(highlighted, k);
+				n++;
+			}
+		}
+	}
+	if(i >= 0 && !ISSET(highlighted, i)) {
+		SETBIT(highlighted, i);
+		n++;
+	}
+	return n;
+}
+
+/* press() looks for held modifiers twice */
+long
+oldmods(int x, int y) {
+	long n = 0;
+	int r, i;
+
+	for(r = 0; r < 2; r++) {
+		for(i = 0; i < NKEYS; i++) {
+			if(old[i].pressed && IsModifierKey(old[i].keysym))
+				n += old[i].keysym;
+		}
+	}
+	return n;
+}
+
+long
+newmods(int x, int y) {
+	long n = 0;
+	int r, j;
+	uint w;
+
+	for(r = 0; r < 2; r++) {
+		for(j = 0; j < NWORDS; j++) {
+			for(w = pressed[j] & modkeys[j]; w; w &= w - 1)
+				n += layout[j * 32 + LOWBIT(w)].keysym;
+		}
+	}
+	return n;
+}
+
+/* unpress() looks for the first pressed key that is no modifier */
+long
+oldfirst(int x, int y) {
+	int i;
+
+	for(i = 0; i < NKEYS; i++) {
+		if(old[i].pressed && !IsModifierKey(old[i].keysym))
+			return i;
+	}
+	return -1;
+}
+
+long
+newfirst(int x, int y) {
+	int j;
+
+	for(j = 0; j < NWORDS && !(pressed[j] & ~modkeys[j]); j++);
+	if(j == NWORDS)
+		return -1;
+	return j * 32 + LOWBIT(pressed[j] & ~modkeys[j]);
+}
+
+void
+run(const char *name, long (*f)(int, int)) {
+	struct timespec t0, t1;
+	volatile long sink = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < NMOTIONS; i++)
+		sink += f(px[i], py[i]);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("%-12s %7.1f ns/call\n", name,
+			((t1.tv_sec - t0.tv_sec) * 1e9
+			 + t1.tv_nsec - t0.tv_nsec) / NMOTIONS);
+}
+
+int
+main(void) {
+	int i, r, c;
+
+	/* a modifier at both ends of every row, then a separator */
+	for(r = 0, i = 0; r < ROWS; r++, i++) {
+		for(c = 0; c < COLS; c++, i++) {
+			layout[i].keysym = c == 0 || c == COLS - 1
+				? XK_Shift_L + r % 8 : XK_a + c % 26;
+			layout[i].width = 1;
+			old[i].keysym = layout[i].keysym;
+			old[i].x = gx[i] = c * KEYSIZE;
+			old[i].y = gy[i] = r * KEYSIZE;
+			old[i].w = gw[i] = KEYSIZE;
+			old[i].h = gh[i] = KEYSIZE;
+			if(IsModifierKey(layout[i].keysym))
+				SETBIT(modkeys, i);
+		}
+	}
+	old[NKEYS / 2].pressed = old[NKEYS / 3].pressed = True;
+	SETBIT(pressed, NKEYS / 2);
+	SETBIT(pressed, NKEYS / 3);
+
+	srand(1);
+	for(i = 0; i < NMOTIONS; i++) {
+		px[i] = rand() % (COLS * KEYSIZE);
+		py[i] = rand() % (ROWS * KEYSIZE);
+		if(oldfind(px[i], py[i]) != newfind(px[i], py[i])) {
+			fprintf(stderr, "scan: findkey differs at %d,%d\n",
+					px[i], py[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%d keys, old Key %zu bytes, "
+			"new Key %zu bytes + 16 geometry + 2 bits\n",
+			NKEYS, sizeof(OldKey), sizeof(Key));
+	run("old findkey", oldfind);
+	run("new findkey", newfind);
+	run("old motion", oldmotion);
+	run("new motion", newmotion);
+	run("old mods", oldmods);
+	run("new mods", newmods);
+	run("old first", oldfirst);
+	run("new first", newfirst);
+	return 0;
+}
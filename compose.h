@@ -0,0 +1,26 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Compose sequences as stored in composetab.h, and the hash used to
+ * look them up, shared between svkbd and mkcompose which generates it.
+ */
+#define COMPOSELEN      4 /* longest sequence following Multi_key */
+
+typedef struct {
+	unsigned int seq[COMPOSELEN]; /* keysyms, padded with 0 */
+	unsigned int result; /* keysym, 0 if seq only starts longer ones */
+} Compose;
+
+static unsigned int
+composehash(const unsigned int *seq, unsigned int seed) {
+	unsigned int h = 2166136261u ^ seed;
+	int i;
+
+	for(i = 0; i < COMPOSELEN; i++)
+		h = (h ^ seq[i]) * 16777619u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
@@ -1,4 +1,30 @@
 static const Bool wmborder = True;
+/* False on touch-only screens, motion is then only watched while pressing */
+static const Bool hoverhighlight = True;
+/* ms of resting the pointer on a key that press it, 0 for no dwell */
+static const uint dwelltime = 0;
+/* size of the preview shown above a pressed key, 0 for no preview */
+static const uint previewscale = 2;
+/* cells per page of the symbol panel, and how many rendered cells to keep,
+ * none of them 0 */
+static const uint symbolcols = 10;
+static const uint symbolrows = 4;
+static const uint symbolcache = 128;
+static const Range symbols[] = {
+	{ 0x00a1, 0x00ff }, /* Latin-1 */
+	{ 0x0391, 0x03c9 }, /* Greek */
+	{ 0x2010, 0x205e }, /* punctuation */
+	{ 0x20a0, 0x20c0 }, /* currency */
+	{ 0x2100, 0x214f }, /* letterlike */
+	{ 0x2190, 0x21ff }, /* arrows */
+	{ 0x2200, 0x22ff }, /* mathematical operators */
+	{ 0x2500, 0x259f }, /* box drawing and blocks */
+	{ 0x25a0, 0x25ff }, /* geometric shapes */
+	{ 0x2600, 0x27bf }, /* symbols and dingbats */
+	{ 0x1f300, 0x1f64f }, /* pictographs and emoticons */
+	{ 0x1f680, 0x1f6ff }, /* transport and map */
+	{ 0x1f900, 0x1f9ff }, /* supplemental pictographs */
+};
 static const char font[] = "-*-terminus-medium-r-normal-*-14-*-*-*-*-*-*-*";
 static const char normbgcolor[] = "#cccccc";
 static const char normfgcolor[] = "#000000";
@@ -12,14 +12,21 @@ MANPREFIX = ${PREFIX}/share/man
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# Compose file composetab.h is generated from
+COMPOSE = /usr/share/X11/locale/en_US.UTF-8/Compose
+
+# Present, comment if you don't want it
+PRESENTLIBS = -lXpresent -lXfixes
+PRESENTFLAGS = -DPRESENT
+
 # includes and libs
 INCS = -I. -I./layouts -I/usr/include -I${X11INC}
-LIBS = -L/usr/lib -lc -L${X11LIB} -lX11 -lXtst
+LIBS = -L/usr/lib -lc -L${X11LIB} -lpthread -lX11 -lXtst -lXrender ${PRESENTLIBS}
 
 # flags
-CPPFLAGS = -DVERSION=\"${VERSION}\" \
-	   ${XINERAMAFLAGS}
-CFLAGS = -g -std=c99 -pedantic -Wall -Os ${INCS} ${CPPFLAGS}
+CPPFLAGS = -DVERSION=\"${VERSION}\" -D_XOPEN_SOURCE=700 \
+	   ${XINERAMAFLAGS} ${PRESENTFLAGS}
+CFLAGS = -g -std=c11 -pedantic -Wall -Os ${INCS} ${CPPFLAGS}
 LDFLAGS = -g ${LIBS}
 
 # Solaris
@@ -0,0 +1,165 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * svkbd-heatmap prints the key usage counters written by svkbd -H and,
+ * given the layout.*.h they were collected with, proposes new key widths.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include "heatmap.h"
+
+#define LENGTH(x)       (sizeof x / sizeof x[0])
+
+/* keys with fewer hits than this are not resized */
+#define MINHITS         50
+
+static void die(const char *errstr, ...);
+static Heatmap *load(const char *path);
+static int propose(HeatKey *k, uint32_t rowhits, int rowkeys);
+static void render(Heatmap *h);
+static void resize(Heatmap *h, const char *path);
+
+static const char shades[] = " .:-=+*#%@";
+
+void
+die(const char *errstr, ...) {
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+Heatmap *
+load(const char *path) {
+	FILE *f;
+	Heatmap *h;
+	long n;
+
+	if(!(f = fopen(path, "r")))
+		die("svkbd-heatmap: cannot open '%s'\n", path);
+	fseek(f, 0, SEEK_END);
+	n = ftell(f);
+	rewind(f);
+	if(n < (long)sizeof(Heatmap) || !(h = malloc(n)))
+		die("svkbd-heatmap: '%s' is not a counter file\n", path);
+	if(fread(h, 1, n, f) != (size_t)n)
+		die("svkbd-heatmap: cannot read '%s'\n", path);
+	fclose(f);
+	if(h->magic != HEATMAGIC || n != (long)(sizeof(Heatmap)
+				+ h->nkeys * sizeof(HeatKey)))
+		die("svkbd-heatmap: '%s' is not a counter file\n", path);
+	return h;
+}
+
+/* Returns the suggested change of width for k. Touches crowding the
+ * outer columns or frequent corrections mean the key is too narrow, a
+ * key hit far less than its row neighbours can give up some room. */
+int
+propose(HeatKey *k, uint32_t rowhits, int rowkeys) {
+	uint32_t edge = 0;
+	int r;
+
+	if(k->hits < MINHITS)
+		return 0;
+	for(r = 0; r < HEATROWS; r++)
+		edge += k->grid[r][0] + k->grid[r][HEATCOLS - 1];
+	if(edge * 2 > k->hits || k->backspace * 10 > k->hits)
+		return 1;
+	if(k->width > 1 && edge * 10 < k->hits
+			&& k->hits * rowkeys * 4 < rowhits)
+		return -1;
+	return 0;
+}
+
+void
+render(Heatmap *h) {
+	HeatKey *k;
+	uint32_t i, total = 0, max;
+	const char *name;
+	int r, c;
+
+	for(i = 0; i < h->nkeys; i++)
+		total += h->keys[i].hits;
+	printf("%u hits on %u keys\n", total, h->nkeys);
+	for(i = 0; i < h->nkeys; i++) {
+		k = &h->keys[i];
+		if(!k->keysym) {
+			putchar('\n');
+			continue;
+		}
+		if(!(name = XKeysymToString(k->keysym)))
+			name = "?";
+		printf("%-14s w%-2u %8u %5.1f%% bs %5.1f%%",
+				name, k->width, k->hits,
+				total ? 100.0 * k->hits / total : 0.0,
+				k->hits ? 100.0 * k->backspace / k->hits : 0.0);
+		for(r = 0, max = 0; r < HEATROWS; r++)
+			for(c = 0; c < HEATCOLS; c++)
+				if(k->grid[r][c] > max)
+					max = k->grid[r][c];
+		for(r = 0; r < HEATROWS; r++) {
+			printf("  |");
+			for(c = 0; c < HEATCOLS; c++)
+				putchar(shades[max ? k->grid[r][c]
+						* (LENGTH(shades) - 2) / max : 0]);
+			putchar('|');
+		}
+		putchar('\n');
+	}
+}
+
+void
+resize(Heatmap *h, const char *path) {
+	FILE *f;
+	char line[BUFSIZ], sym[64], *p;
+	uint32_t i, j, rowhits;
+	int l, d, rowkeys;
+	unsigned int w;
+	KeySym ks;
+
+	if(!(f = fopen(path, "r")))
+		die("svkbd-heatmap: cannot open '%s'\n", path);
+	putchar('\n');
+	for(i = 0, l = 1; fgets(line, sizeof line, f); l++) {
+		if(!(p = strstr(line, "XK_"))
+				|| sscanf(p, "XK_%63[A-Za-z0-9_] , %u", sym, &w) != 2)
+			continue;
+		while(i < h->nkeys && !h->keys[i].keysym)
+			i++;
+		/* svkbd's own keysyms like XK_SvkbdSymbols have no name */
+		ks = XStringToKeysym(sym);
+		if(i == h->nkeys || (ks != NoSymbol && h->keys[i].keysym != ks))
+			die("svkbd-heatmap: %s:%d: XK_%s does not match counters\n",
+					path, l, sym);
+
+		/* hits of the row this key is in */
+		for(j = i; j > 0 && h->keys[j - 1].keysym; j--);
+		for(rowhits = 0, rowkeys = 0; j < h->nkeys && h->keys[j].keysym;
+				j++, rowkeys++)
+			rowhits += h->keys[j].hits;
+
+		if((d = propose(&h->keys[i], rowhits, rowkeys)))
+			printf("%s:%d: XK_%s width %u -> %u\n", path, l, sym,
+					w, w + d);
+		i++;
+	}
+	fclose(f);
+}
+
+int
+main(int argc, char *argv[]) {
+	Heatmap *h;
+
+	if(argc < 2 || argc > 3)
+		die("usage: svkbd-heatmap counters [layout.h]\n");
+	h = load(argv[1]);
+	render(h);
+	if(argc == 3)
+		resize(h, argv[2]);
+	free(h);
+	return 0;
+}
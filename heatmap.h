@@ -0,0 +1,25 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Layout of the key usage counter file, shared between svkbd (which
+ * updates it through a shared mapping) and svkbd-heatmap (which reads it).
+ * Only counts and touch positions are kept, never sequences of keys.
+ */
+#include <stdint.h>
+
+#define HEATMAGIC       0x484b5653 /* "SVKH" */
+#define HEATROWS        3
+#define HEATCOLS        5
+
+typedef struct {
+	uint32_t keysym;
+	uint32_t width;
+	uint32_t hits;
+	uint32_t backspace; /* times BackSpace was hit right after this key */
+	uint32_t grid[HEATROWS][HEATCOLS]; /* where inside the key it was hit */
+} HeatKey;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t nkeys;
+	HeatKey keys[];
+} Heatmap;
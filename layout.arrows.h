@@ -1,4 +1,4 @@
-static Key keys[] = {
+const Key keys[] = {
 	{ 0, XK_Shift_L, 2 },
 	{ "←", XK_Left, 1 },
 	{ "↓", XK_Down, 1 },
@@ -8,7 +8,7 @@ static Key keys[] = {
 	{ "[X]", XK_Cancel, 1 },
 };
 
-Buttonmod buttonmods[] = {
+const Buttonmod buttonmods[] = {
 	{ XK_Shift_L, Button2 },
 	{ XK_Alt_L, Button3 },
 };
@@ -0,0 +1,18 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Compiled once for every layout.*.h, given as -DLAYOUT, into the layout
+ * object svkbd.o is linked with.
+ */
+#include <X11/keysym.h>
+#include <X11/Xlib.h>
+#include "svkbd.h"
+
+#include LAYOUT
+
+const uint nkeys = LENGTH(keys);
+const uint nbuttonmods = LENGTH(buttonmods);
+#ifdef NO_REPEAT
+const Bool norepeat = True;
+#else
+const Bool norepeat = False;
+#endif
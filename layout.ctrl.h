@@ -1,5 +1,5 @@
 #define NO_REPEAT 1
-static Key keys[] = {
+const Key keys[] = {
 	{ "↑", XK_Up, 1 },
 	{ "↓", XK_Down, 1 },
 	{ "←", XK_Left, 1 },
@@ -14,7 +14,7 @@ static Key keys[] = {
 	{ "[X]", XK_Cancel, 1},
 };
 
-Buttonmod buttonmods[] = {
+const Buttonmod buttonmods[] = {
 	{ XK_Super_L, Button2 },
 	{ XK_Control_L, Button3 },
 };
@@ -1,4 +1,4 @@
-static Key keys[] = {
+const Key keys[] = {
 	{ "^ °′", XK_dead_circumflex, 1},
 	{ "1 !¹", XK_1, 1 },
 	{ "2 \"²", XK_2, 1 },
@@ -67,13 +67,15 @@ static Key keys[] = {
 	{ "", XK_space, 5 },
 	{ "Alt Gr", XK_ISO_Level3_Shift, 2 },
 	{ "Menu", XK_Menu, 1 },
+	{ "Cmp", XK_Multi_key, 1 },
+	{ "Sym", XK_SvkbdSymbols, 1 },
 	{ "Ctrl", XK_Control_R, 2 },
 	{ "←", XK_Left, 1 },
 	{ "↓", XK_Down, 1 },
 	{ "→", XK_Right, 1 },
 };
 
-Buttonmod buttonmods[] = {
+const Buttonmod buttonmods[] = {
 	{ XK_Shift_L, Button2 },
 	{ XK_Alt_L, Button3 },
 };
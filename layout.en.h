@@ -1,4 +1,4 @@
-static Key keys[] = {
+const Key keys[] = {
 	{ "1!", XK_1, 1 },
 	{ "2@", XK_2, 1 },
 	{ "3#", XK_3, 1 },
@@ -59,11 +59,13 @@ static Key keys[] = {
 	{ "Alt", XK_Alt_L, 2 },
 	{ "", XK_space, 5 },
 	{ "Alt", XK_Alt_R, 2 },
+	{ "Cmp", XK_Multi_key, 1 },
+	{ "Sym", XK_SvkbdSymbols, 1 },
 	{ "Ctrl", XK_Control_R, 2 },
 	{ "[X]", XK_Cancel, 1},
 };
 
-Buttonmod buttonmods[] = {
+const Buttonmod buttonmods[] = {
 	{ XK_Shift_L, Button2 },
 	{ XK_Alt_L, Button3 },
 };
@@ -1,4 +1,4 @@
-static Key keys[] = {
+const Key keys[] = {
 	{ "ёЁ", XK_Cyrillic_io, 1 },
 	{ "1!", XK_1, 1 },
 	{ "2\"", XK_2, 1 },
@@ -65,7 +65,7 @@ static Key keys[] = {
 	{ "[X]", XK_Cancel, 1},
 };
 
-Buttonmod buttonmods[] = {
+const Buttonmod buttonmods[] = {
 	{ XK_Shift_L, Button2 },
 	{ XK_Alt_L, Button3 },
 };
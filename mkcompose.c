@@ -0,0 +1,211 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * mkcompose reads an X Compose file on stdin and writes composetab.h,
+ * the Multi_key sequences in it as a perfect hash table: a key's bucket
+ * composedisp[hash(seq, 0) % buckets] holds the seed that places it at
+ * composetab[hash(seq, seed) % slots] without collisions.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include "compose.h"
+
+#define MAXSEEDS        (1 << 20)
+
+typedef unsigned int uint;
+
+typedef struct {
+	uint id, n;
+	uint *items; /* indices into entries */
+} Bucket;
+
+static void add(const uint *seq, uint result);
+static int bucketcmp(const void *a, const void *b);
+static int composecmp(const void *a, const void *b);
+static void die(const char *errstr, ...);
+static uint parse(char *line, uint *seq);
+static uint utf8decode(const char *s);
+
+static Compose *entries;
+static uint nentries = 0, maxentries = 0;
+
+void
+add(const uint *seq, uint result) {
+	if(nentries == maxentries) {
+		maxentries = maxentries ? maxentries * 2 : 1024;
+		if(!(entries = realloc(entries, maxentries * sizeof(Compose))))
+			die("mkcompose: cannot allocate memory\n");
+	}
+	memcpy(entries[nentries].seq, seq, sizeof(entries->seq));
+	entries[nentries++].result = result;
+}
+
+int
+bucketcmp(const void *a, const void *b) {
+	return ((const Bucket *)b)->n - ((const Bucket *)a)->n;
+}
+
+/* by sequence, complete sequences before prefixes of the same keys */
+int
+composecmp(const void *a, const void *b) {
+	const Compose *ca = a, *cb = b;
+	int i;
+
+	for(i = 0; i < COMPOSELEN; i++) {
+		if(ca->seq[i] != cb->seq[i])
+			return ca->seq[i] < cb->seq[i] ? -1 : 1;
+	}
+	return (ca->result == 0) - (cb->result == 0);
+}
+
+void
+die(const char *errstr, ...) {
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+/* Returns the resulting keysym of a "<Multi_key> <a> ... : "x" keysym"
+ * line and fills seq, or 0 if the line is of no use to svkbd. */
+uint
+parse(char *line, uint *seq) {
+	char *p, *q, name[64];
+	uint n, ks;
+
+	if(strncmp(line, "<Multi_key>", 11))
+		return 0;
+	memset(seq, 0, COMPOSELEN * sizeof(uint));
+	for(p = line + 11, n = 0; (p = strpbrk(p, "<:")) && *p == '<'; n++) {
+		if(!(q = strchr(p, '>')) || (size_t)(q - p) > sizeof name
+				|| n == COMPOSELEN)
+			return 0;
+		memcpy(name, p + 1, q - p - 1);
+		name[q - p - 1] = '\0';
+		if((seq[n] = XStringToKeysym(name)) == NoSymbol)
+			return 0;
+		p = q;
+	}
+	if(!p || n == 0 || !(p = strchr(p, '"')) || !(q = strchr(p + 1, '"')))
+		return 0;
+	*q = '\0';
+	if(sscanf(q + 1, " %63[A-Za-z0-9_]", name) == 1
+			&& (ks = XStringToKeysym(name)) != NoSymbol)
+		return ks;
+	/* no keysym name, a single character can still be typed */
+	if(p[1] == '\\' || !(ks = utf8decode(p + 1)))
+		return 0;
+	return ks < 0x100 ? ks : 0x01000000 | ks;
+}
+
+/* the code point of a string of exactly one character, else 0 */
+uint
+utf8decode(const char *s) {
+	const unsigned char *u = (const unsigned char *)s;
+	uint cp, n, i;
+
+	if(u[0] < 0x80)
+		return u[0] >= 0x20 && !u[1] ? u[0] : 0;
+	else if((u[0] & 0xe0) == 0xc0)
+		cp = u[0] & 0x1f, n = 1;
+	else if((u[0] & 0xf0) == 0xe0)
+		cp = u[0] & 0x0f, n = 2;
+	else if((u[0] & 0xf8) == 0xf0)
+		cp = u[0] & 0x07, n = 3;
+	else
+		return 0;
+	for(i = 1; i <= n; i++) {
+		if((u[i] & 0xc0) != 0x80)
+			return 0;
+		cp = cp << 6 | (u[i] & 0x3f);
+	}
+	return u[i] || cp < 0xa0 ? 0 : cp;
+}
+
+int
+main(void) {
+	char line[BUFSIZ];
+	uint seq[COMPOSELEN], pre[COMPOSELEN];
+	uint i, j, k, n, result, nb, m, seed, *seeds;
+	Bucket *b;
+	Compose *tab;
+	char *used;
+
+	while(fgets(line, sizeof line, stdin)) {
+		if(!(result = parse(line, seq)))
+			continue;
+		add(seq, result);
+		/* prefixes tell svkbd to wait for more keys */
+		memset(pre, 0, sizeof pre);
+		for(i = 0; i + 1 < COMPOSELEN && seq[i + 1]; i++) {
+			pre[i] = seq[i];
+			add(pre, 0);
+		}
+	}
+	if(!nentries)
+		die("mkcompose: no Multi_key sequences on stdin\n");
+
+	/* one entry per sequence, a complete one wins over a prefix */
+	qsort(entries, nentries, sizeof(Compose), composecmp);
+	for(i = 1, n = 1; i < nentries; i++) {
+		if(memcmp(entries[i].seq, entries[n - 1].seq, sizeof(seq)))
+			entries[n++] = entries[i];
+	}
+
+	nb = n / 4 + 1;
+	m = n + n / 4 + 1;
+	if(!(b = calloc(nb, sizeof(Bucket))) || !(seeds = calloc(nb, sizeof(uint)))
+			|| !(tab = calloc(m, sizeof(Compose)))
+			|| !(used = calloc(m, 1)))
+		die("mkcompose: cannot allocate memory\n");
+	for(i = 0; i < nb; i++)
+		b[i].id = i;
+	for(i = 0; i < n; i++) {
+		k = composehash(entries[i].seq, 0) % nb;
+		if(!(b[k].items = realloc(b[k].items, ++b[k].n * sizeof(uint))))
+			die("mkcompose: cannot allocate memory\n");
+		b[k].items[b[k].n - 1] = i;
+	}
+
+	/* fullest buckets first, each gets the first seed fitting all keys */
+	qsort(b, nb, sizeof(Bucket), bucketcmp);
+	for(i = 0; i < nb && b[i].n; i++) {
+		for(seed = 1; seed < MAXSEEDS; seed++) {
+			for(j = 0; j < b[i].n; j++) {
+				k = composehash(entries[b[i].items[j]].seq, seed) % m;
+				if(used[k])
+					break;
+				used[k] = 1;
+			}
+			if(j == b[i].n)
+				break;
+			while(j--)
+				used[composehash(entries[b[i].items[j]].seq, seed) % m] = 0;
+		}
+		if(seed == MAXSEEDS)
+			die("mkcompose: no perfect hash found\n");
+		for(j = 0; j < b[i].n; j++) {
+			k = composehash(entries[b[i].items[j]].seq, seed) % m;
+			tab[k] = entries[b[i].items[j]];
+		}
+		seeds[b[i].id] = seed;
+	}
+
+	printf("/* generated by mkcompose, do not edit */\n"
+	       "static const uint composedisp[] = {");
+	for(i = 0; i < nb; i++)
+		printf("%s%u,", i % 12 ? " " : "\n\t", seeds[i]);
+	printf("\n};\n\nstatic const Compose composetab[] = {\n");
+	for(i = 0; i < m; i++) {
+		printf("\t{ {");
+		for(j = 0; j < COMPOSELEN; j++)
+			printf(" 0x%x,", tab[i].seq[j]);
+		printf(" }, 0x%x },\n", tab[i].result);
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * svkbd-steno reads a steno dictionary on stdin, one "chord text" line
+ * per entry, and writes the file svkbd -S maps to stdout. The chord is
+ * written as its keys in any order, "stk" and "kts" are the same chord.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "steno.h"
+
+typedef unsigned int uint;
+
+static void die(const char *errstr, ...);
+static void *erealloc(void *p, size_t size);
+
+void
+die(const char *errstr, ...) {
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+void *
+erealloc(void *p, size_t size) {
+	if(!(p = realloc(p, size)))
+		die("svkbd-steno: cannot allocate memory\n");
+	return p;
+}
+
+int
+main(void) {
+	char line[BUFSIZ], *p, *q;
+	StenoSlot *entries = NULL, *slots;
+	uint32_t *from; /* offsets of the texts before they are packed */
+	Steno h;
+	char *texts = NULL;
+	size_t ntexts = 0, off;
+	uint n = 0, max = 0, i, k, l, dups = 0;
+	int b;
+
+	for(l = 1; fgets(line, sizeof line, stdin); l++) {
+		p = line + strspn(line, " \t");
+		if(*p == '#' || *p == '\n' || !*p)
+			continue;
+		if(n == max) {
+			max = max ? max * 2 : 1024;
+			entries = erealloc(entries, max * sizeof(StenoSlot));
+		}
+		entries[n].chord = 0;
+		for(; *p && !strchr(" \t\n", *p); p++) {
+			if((b = stenobit((unsigned char)*p)) < 0)
+				die("svkbd-steno: %u: '%c' is no chord key\n",
+						l, *p);
+			entries[n].chord |= (uint64_t)1 << b;
+		}
+		p += strspn(p, " \t");
+		for(q = p + strlen(p); q > p && strchr(" \t\n", q[-1]); q--);
+		if(q == p)
+			die("svkbd-steno: %u: chord without text\n", l);
+		if(ntexts + (q - p) > UINT32_MAX)
+			die("svkbd-steno: dictionary too large\n");
+		texts = erealloc(texts, ntexts + (q - p));
+		memcpy(texts + ntexts, p, q - p);
+		entries[n].text = ntexts;
+		entries[n++].len = q - p;
+		ntexts += q - p;
+	}
+
+	/* at most half full, probe sequences stay short */
+	for(h.nslots = 2; h.nslots < 2 * n; h.nslots *= 2);
+	h.magic = STENOMAGIC;
+	slots = calloc(h.nslots, sizeof(StenoSlot));
+	if(!slots)
+		die("svkbd-steno: cannot allocate memory\n");
+	for(i = 0; i < n; i++) {
+		k = stenohash(entries[i].chord) & (h.nslots - 1);
+		for(; slots[k].chord && slots[k].chord != entries[i].chord;
+				k = (k + 1) & (h.nslots - 1));
+		if(slots[k].chord)
+			dups++; /* the first entry of a chord wins */
+		else
+			slots[k] = entries[i];
+	}
+	if(dups)
+		fprintf(stderr, "svkbd-steno: %u repeated chords ignored\n",
+				dups);
+
+	/* the texts follow in slot order, without those of ignored chords */
+	from = erealloc(NULL, h.nslots * sizeof(uint32_t));
+	for(i = 0, off = 0; i < h.nslots; i++) {
+		from[i] = slots[i].text;
+		slots[i].text = off;
+		off += slots[i].len;
+	}
+	if(fwrite(&h, sizeof h, 1, stdout) != 1
+			|| fwrite(slots, sizeof(StenoSlot), h.nslots, stdout)
+			!= h.nslots)
+		die("svkbd-steno: cannot write dictionary\n");
+	for(i = 0; i < h.nslots; i++) {
+		if(fwrite(texts + from[i], 1, slots[i].len, stdout)
+				!= slots[i].len)
+			die("svkbd-steno: cannot write dictionary\n");
+	}
+	if(fflush(stdout))
+		die("svkbd-steno: cannot write dictionary\n");
+	return 0;
+}
@@ -0,0 +1,41 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Steno dictionary file, written by svkbd-steno and mapped by svkbd -S:
+ * a hash table of chords with linear probing, followed by the texts of
+ * its entries. A chord is the set of keys pressed together.
+ */
+#include <stdint.h>
+
+#define STENOMAGIC      0x4e545653 /* "SVTN" */
+
+typedef struct {
+	uint64_t chord; /* one stenobit() per key, 0 if the slot is empty */
+	uint32_t text; /* offset into the texts after the last slot */
+	uint32_t len;
+} StenoSlot;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t nslots; /* a power of two */
+	StenoSlot slots[];
+} Steno;
+
+/* the bit of the chord for keysym or character c, a-z and 0-9, else -1 */
+static int
+stenobit(unsigned long c) {
+	if(c >= 'a' && c <= 'z')
+		return c - 'a';
+	if(c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if(c >= '0' && c <= '9')
+		return 26 + c - '0';
+	return -1;
+}
+
+static uint32_t
+stenohash(uint64_t chord) {
+	chord ^= chord >> 33;
+	chord *= 0xff51afd7ed558ccdULL;
+	chord ^= chord >> 33;
+	return chord;
+}
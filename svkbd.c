@@ -2,28 +2,55 @@
  *
  * To understand svkbd, start reading main().
  */
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/XKBlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xproto.h>
 #include <X11/extensions/XTest.h>
+#include <X11/extensions/Xrender.h>
+#ifdef PRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+#include "compose.h"
+#include "heatmap.h"
+#include "steno.h"
+#include "svkbd.h"
 
 /* macros */
 #define MAX(a, b)       ((a) > (b) ? (a) : (b))
-#define LENGTH(x)       (sizeof x / sizeof x[0])
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define BITWORDS(n)     (((n) + 31) / 32)
+#define ISSET(s, i)     ((s)[(i) / 32] >> (i) % 32 & 1)
+#define SETBIT(s, i)    ((s)[(i) / 32] |= 1U << (i) % 32)
+#define CLRBIT(s, i)    ((s)[(i) / 32] &= ~(1U << (i) % 32))
+#define LOWBIT(w)       (ffs((int)(w)) - 1)
+#define DWELLSTEPS      8 /* strips of the dwell progress bar */
 
 /* enums */
 enum { ColFG, ColBG, ColLast };
 enum { NetWMWindowType, NetLast };
+enum { SymPrev, SymNext, SymBack, SymLast }; /* symbol panel controls */
 
 /* typedefs */
-typedef unsigned int uint;
 typedef unsigned long ulong;
 
 typedef struct {
@@ -43,120 +70,275 @@ typedef struct {
 } DC; /* draw context */
 
 typedef struct {
-	char *label;
-	KeySym keysym;
-	uint width;
-	int x, y, w, h;
-	Bool pressed;
-	Bool highlighted;
-} Key;
+	int *x, *y, *w, *h;
+} Geom; /* of every key, one array per field */
 
 typedef struct {
-	KeySym mod;
-	uint button;
-} Buttonmod;
+	uint first, last;
+} Range; /* of Unicode code points */
+
+typedef struct {
+	uint cp;
+	Pixmap pm; /* one symbol panel cell, None if unused */
+	ulong used; /* for evicting the least recently used */
+} Cell;
+
+typedef struct {
+	Display *dpy; /* NULL stops the injector */
+	uint keycode;
+	KeySym keysym; /* if set, keycode is bound to it first */
+	Bool press;
+	struct timespec pressed; /* of the ButtonPress it is for, with -s */
+} Inject;
+
+typedef struct Kbd Kbd;
+struct Kbd {
+	Display *dpy;
+	Display *idpy; /* only used by the injector thread */
+	int screen;
+	Window root, win;
+	Atom netatom[NetLast];
+	DC dc;
+	Geom geom;
+	uint *pressed, *highlighted; /* bitsets over keys[] */
+	KeySym pressedmod;
+	int composekey; /* Multi_key while a sequence is entered, else -1 */
+	uint composeseq[COMPOSELEN];
+	int ncompose;
+	KeyCode sparecode; /* has no keysyms, for typing any keysym */
+	Bool ispressing, isvisible;
+	int ww, wh, wx, wy;
+	int lastkey;
+	XRectangle damaged; /* of dc.drawable, not yet on the window */
+	Bool stale; /* dc.drawable is missing draws, skipped or not done yet */
+	Region exposed; /* of the window, collected until an expose count 0 */
+	Window preview;
+	Picture previewsrc, previewdst;
+	Bool previewshown;
+	Bool steno; /* keys form chords, looked up when released */
+	Bool chording; /* the keys pressed since ButtonPress are a chord */
+	int dwellkey; /* hovered key or panel cell, -1 if none */
+	int dwelldrawn; /* progress strips on it, -1 once it was pressed */
+	struct timespec dwellstart;
+	Bool panel; /* the symbol panel is shown instead of keys[] */
+	uint page;
+	int panelcell; /* held down, -1 if none */
+	Cell *glyphs; /* symbolcache rendered cells */
+	ulong glyphtick;
+#ifdef PRESENT
+	int presentopcode;
+	Bool presentpending;
+	uint presentserial;
+	XserverRegion presentregion;
+#endif
+	atomic_bool dead; /* its display is gone, see xioerror() */
+	Kbd *next;
+}; /* one keyboard per display */
 
 /* function declarations */
 static void motionnotify(XEvent *e);
 static void buttonpress(XEvent *e);
 static void buttonrelease(XEvent *e);
+static void cellaction(int c);
+static void cellrect(int c, XRectangle *r);
 static void cleanup(void);
+static void chord(void);
+static void compose(int k, KeySym mod);
 static void configurenotify(XEvent *e);
-static void countrows();
+static void countkey(int k, int x, int y);
+static double cputime(void);
 static void die(const char *errstr, ...);
+static void damage(const XRectangle *r);
+static void drawbox(Drawable d, XRectangle r, const char *l, const ulong *col);
+static void drawcell(int c, Bool pressed);
 static void drawkeyboard(void);
-static void drawkey(Key *k);
+static void drawkey(int k);
+static void drawpanel(void);
+static void dwell(void);
+static void dwellon(int t);
+static int dwelltimeout(void);
+static void *ecalloc(size_t nmemb, size_t size);
+static void enqueue(Display *dpy, uint keycode, KeySym keysym, Bool press);
 static void expose(XEvent *e);
-static Key *findkey(int x, int y);
+static const Compose *findcompose(const uint *seq);
+static const StenoSlot *findsteno(uint64_t chord);
+static int findcell(int x, int y);
+static int findkey(int x, int y);
+static void flushglyphs(void);
+static void genericevent(XEvent *e);
 static ulong getcolor(const char *colstr);
+static Pixmap getglyph(uint cp, int w, int h);
+static void hidepreview(void);
 static void initfont(const char *fontstr);
+static void initheatmap(const char *path);
+static void initinjector(void);
+static void initlayout(void);
+static void initpreview(void);
+static void initsteno(const char *path);
+static void inject(KeySym keysym, Bool press);
+static void *injector(void *arg);
 static void leavenotify(XEvent *e);
-static void press(Key *k, KeySym mod);
+static void mappingnotify(XEvent *e);
+static long msince(const struct timespec *t);
+static void panelpress(int x, int y);
+static void panelrelease(int x, int y);
+static void printstats(Bool force);
+static long rss(void);
+static void present(void);
+static void press(int k, KeySym mod);
 static void run(void);
 static void setup(void);
+static void setpreviewsrc(void);
+static void showpreview(int k);
+static uint symbolat(uint i);
 static int textnw(const char *text, uint len);
-static void unpress(Key *k, KeySym mod);
+static void typekeysym(KeySym keysym);
+static void typestring(const char *s, uint len);
+static void unpress(int k, KeySym mod);
+static void unmapnotify(XEvent *e);
 static void updatekeys();
+static int utf8encode(uint cp, char *s);
+static void visibilitynotify(XEvent *e);
+static void xioerror(Display *dpy, void *arg);
 
 /* variables */
-static int screen;
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
 	[ButtonRelease] = buttonrelease,
 	[ConfigureNotify] = configurenotify,
 	[Expose] = expose,
+	[GenericEvent] = genericevent,
 	[LeaveNotify] = leavenotify,
-	[MotionNotify] = motionnotify
+	[MappingNotify] = mappingnotify,
+	[MotionNotify] = motionnotify,
+	[UnmapNotify] = unmapnotify,
+	[VisibilityNotify] = visibilitynotify
 };
-static Atom netatom[NetLast];
-static Display *dpy;
-static DC dc;
-static Window root, win;
-static Bool running = True, isdock = False;
-static KeySym pressedmod = 0;
-static int rows = 0, ww = 0, wh = 0, wx = 0, wy = 0;
+static Bool running = True, isdock = False, showstats = False;
+static int rows = 0;
+static uint nwords = 0; /* of each bitset */
+static uint *modkeys = NULL; /* keys[] that are modifiers */
+static uint nsymbols = 0, npages = 0; /* of the symbol panel */
+static const char *symbolcontrols[SymLast] = { "<<", ">>", "abc" };
+static int gx = 0, gy = 0, gw = 0, gh = 0; /* -g, for every display */
 static char *name = "svkbd";
-
-Bool ispressing = False;
-
-/* configuration, allows nested code to access above variables */
-#include "config.h"
-#include "layout.h"
+static char *heatfile = NULL;
+static Heatmap *heat = NULL;
+static char *stenofile = NULL;
+static Steno *steno = NULL;
+static size_t stenosize = 0;
+static ulong wakeups = 0, frames = 0, previews = 0, previewns = 0;
+static ulong flips = 0, flipns = 0, exposes = 0, redraws = 0;
+static struct timespec pressedat; /* stamped on queued events, with -s */
+static atomic_ulong injections = 0, injectns = 0;
+static time_t statsince;
+static double statcpu;
+static Kbd *kbds = NULL, *kb = NULL;
+
+/* key events go from the event loop to the injector thread through a
+ * single producer, single consumer ring */
+static Inject injectq[256];
+static atomic_uint injecthead = 0;
+static sem_t injectsem, injectfree;
+static pthread_t injectthread;
+
+/* configuration, allows nested code to access above variables,
+ * the benchmarks build svkbd.c with their own CONFIG */
+#ifndef CONFIG
+#define CONFIG "config.h"
+#endif
+#include CONFIG
+#include "composetab.h"
 
 void
 motionnotify(XEvent *e)
 {
 	XPointerMovedEvent *ev = &e->xmotion;
-	int i;
-
-	for(i = 0; i < LENGTH(keys); i++) {
-		if(keys[i].keysym && ev->x > keys[i].x
-				&& ev->x < keys[i].x + keys[i].w
-				&& ev->y > keys[i].y
-				&& ev->y < keys[i].y + keys[i].h) {
-			if(keys[i].highlighted != True) {
-				if(ispressing) {
-					keys[i].pressed = True;
-				} else {
-					keys[i].highlighted = True;
-				}
-				drawkey(&keys[i]);
+	Window dummy;
+	int i, j, k, di;
+	uint dui, w;
+
+	if(kb->panel) {
+		if(dwelltime)
+			dwellon(kb->ispressing ? -1 : findcell(ev->x, ev->y));
+		return;
+	}
+	/* hint mode: one event, then ask where the pointer is now */
+	if(ev->is_hint == NotifyHint)
+		XQueryPointer(kb->dpy, kb->win, &dummy, &dummy, &di, &di,
+				&ev->x, &ev->y, &dui);
+	i = findkey(ev->x, ev->y);
+	if(dwelltime)
+		dwellon(kb->ispressing ? -1 : i);
+
+	/* keys the pointer has left are released and lose their highlight,
+	 * a chord keeps all keys until ButtonRelease */
+	for(j = 0; j < nwords; j++) {
+		w = kb->chording ? 0 : kb->pressed[j] & ~modkeys[j];
+		for(; w; w &= w - 1) {
+			k = j * 32 + LOWBIT(w);
+			if(k != i && ISSET(kb->pressed, k)) {
+				unpress(k, 0);
+				drawkey(k);
 			}
-			continue;
 		}
-
-		if(!IsModifierKey(keys[i].keysym) && keys[i].pressed == True) {
-			unpress(&keys[i], 0);
-
-			drawkey(&keys[i]);
-		}
-		if(keys[i].highlighted == True) {
-			keys[i].highlighted = False;
-			drawkey(&keys[i]);
+		for(w = kb->highlighted[j]; w; w &= w - 1) {
+			k = j * 32 + LOWBIT(w);
+			if(k != i) {
+				CLRBIT(kb->highlighted, k);
+				drawkey(k);
+			}
 		}
 	}
+	if(i < 0 || ISSET(kb->highlighted, i))
+		return;
+	if(!kb->ispressing) {
+		SETBIT(kb->highlighted, i);
+		drawkey(i);
+	} else if(!ISSET(kb->pressed, i) && (!kb->chording
+				|| stenobit(keys[i].keysym) >= 0)) {
+		SETBIT(kb->pressed, i);
+		drawkey(i);
+		showpreview(i);
+	}
 }
 
 void
 buttonpress(XEvent *e) {
 	int i;
 	XButtonPressedEvent *ev = &e->xbutton;
-	Key *k;
+	int k;
 	KeySym mod = 0;
 
-	ispressing = True;
+	kb->ispressing = True;
+	kb->dwelldrawn = -1; /* clicked, no dwell until the pointer moves on */
+	if(kb->panel) {
+		panelpress(ev->x, ev->y);
+		return;
+	}
 
-	for(i = 0; i < LENGTH(buttonmods); i++) {
+	for(i = 0; i < nbuttonmods; i++) {
 		if(ev->button == buttonmods[i].button) {
 			mod = buttonmods[i].mod;
 			break;
 		}
 	}
-	if((k = findkey(ev->x, ev->y))) {
+	if((k = findkey(ev->x, ev->y)) >= 0) {
+		countkey(k, ev->x, ev->y);
+		if(kb->steno && stenobit(keys[k].keysym) >= 0) {
+			kb->chording = True;
+			SETBIT(kb->pressed, k);
+			drawkey(k);
+			showpreview(k);
+			return;
+		}
+		if(showstats)
+			clock_gettime(CLOCK_MONOTONIC, &pressedat);
 		press(k, mod);
-#ifdef NO_REPEAT
-		unpress(k, mod);
-#endif
+		pressedat.tv_sec = pressedat.tv_nsec = 0;
+		showpreview(k);
+		if(norepeat)
+			unpress(k, mod);
 	}
 }
 
@@ -164,12 +346,22 @@ void
 buttonrelease(XEvent *e) {
 	int i;
 	XButtonPressedEvent *ev = &e->xbutton;
-	Key *k;
+	int k;
 	KeySym mod = 0;
 
-	ispressing = False;
+	kb->ispressing = False;
+	hidepreview();
+	if(kb->panel) {
+		panelrelease(ev->x, ev->y);
+		return;
+	}
+	if(kb->chording) {
+		kb->chording = False;
+		chord();
+		return;
+	}
 
-	for(i = 0; i < LENGTH(buttonmods); i++) {
+	for(i = 0; i < nbuttonmods; i++) {
 		if(ev->button == buttonmods[i].button) {
 			mod = buttonmods[i].mod;
 			break;
@@ -177,48 +369,252 @@ buttonrelease(XEvent *e) {
 	}
 
 	if(ev->x < 0 || ev->y < 0) {
-		unpress(NULL, mod);
+		unpress(-1, mod);
 	} else {
-		if((k = findkey(ev->x, ev->y)))
+		if((k = findkey(ev->x, ev->y)) >= 0)
 			unpress(k, mod);
 	}
 }
 
+/* Releases the keys of the chord just entered and types its text from
+ * the steno dictionary, followed by a space. */
+void
+chord(void) {
+	const StenoSlot *e;
+	uint64_t c = 0;
+	int i, j, b;
+	uint w;
+
+	for(j = 0; j < nwords; j++) {
+		w = kb->pressed[j] & ~modkeys[j];
+		kb->pressed[j] &= ~w;
+		for(; w; w &= w - 1) {
+			i = j * 32 + LOWBIT(w);
+			if((b = stenobit(keys[i].keysym)) >= 0)
+				c |= (uint64_t)1 << b;
+			drawkey(i);
+		}
+	}
+	if(!(e = findsteno(c)))
+		return;
+	typestring((const char *)&steno->slots[steno->nslots] + e->text,
+			e->len);
+	typekeysym(XK_space);
+}
+
+/* what releasing or dwelling on panel cell c does */
+void
+cellaction(int c) {
+	int n = symbolcols * symbolrows;
+	uint cp;
+
+	switch(c - n) {
+	case SymPrev:
+		if(npages)
+			kb->page = (kb->page + npages - 1) % npages;
+		drawkeyboard();
+		break;
+	case SymNext:
+		if(npages)
+			kb->page = (kb->page + 1) % npages;
+		drawkeyboard();
+		break;
+	case SymBack:
+		kb->panel = False;
+		kb->dwellkey = -1; /* was a cell, not a key */
+		drawkeyboard();
+		break;
+	default:
+		drawcell(c, False);
+		if(kb->page * n + c >= nsymbols)
+			break;
+		cp = symbolat(kb->page * n + c);
+		typekeysym(cp < 0x100 ? cp : 0x01000000 | cp);
+		break;
+	}
+}
+
+/* the symbol panel is a grid of symbols above a row of SymLast controls */
+void
+cellrect(int c, XRectangle *r) {
+	int n = symbolcols * symbolrows;
+
+	r->height = (kb->wh - 1) / (symbolrows + 1);
+	if(c < n) {
+		r->width = (kb->ww - 1) / symbolcols;
+		r->x = c % symbolcols * r->width;
+		r->y = c / symbolcols * r->height;
+	} else {
+		r->width = (kb->ww - 1) / SymLast;
+		r->x = (c - n) * r->width;
+		r->y = symbolrows * r->height;
+	}
+}
+
 void
 cleanup(void) {
-	if(dc.font.set)
-		XFreeFontSet(dpy, dc.font.set);
-	else
-		XFreeFont(dpy, dc.font.xfont);
-	XFreePixmap(dpy, dc.drawable);
-	XFreeGC(dpy, dc.gc);
-	XDestroyWindow(dpy, win);
-	XSync(dpy, False);
-	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
+	Kbd *next;
+	KeySym nosymbol = NoSymbol;
+
+	enqueue(NULL, 0, 0, False);
+	pthread_join(injectthread, NULL);
+	for(kb = kbds; kb; kb = next) {
+		next = kb->next;
+		if(kb->dc.font.set)
+			XFreeFontSet(kb->dpy, kb->dc.font.set);
+		else
+			XFreeFont(kb->dpy, kb->dc.font.xfont);
+		flushglyphs();
+		free(kb->glyphs);
+		XDestroyRegion(kb->exposed);
+		XFreePixmap(kb->dpy, kb->dc.drawable);
+		XFreeGC(kb->dpy, kb->dc.gc);
+		if(previewscale) {
+			XRenderFreePicture(kb->dpy, kb->previewsrc);
+			XRenderFreePicture(kb->dpy, kb->previewdst);
+			XDestroyWindow(kb->dpy, kb->preview);
+		}
+#ifdef PRESENT
+		if(kb->presentopcode)
+			XFixesDestroyRegion(kb->dpy, kb->presentregion);
+#endif
+		XDestroyWindow(kb->dpy, kb->win);
+		if(kb->sparecode)
+			XChangeKeyboardMapping(kb->dpy, kb->sparecode, 1,
+					&nosymbol, 1);
+		XSync(kb->dpy, False);
+		XSetInputFocus(kb->dpy, PointerRoot, RevertToPointerRoot,
+				CurrentTime);
+		XCloseDisplay(kb->dpy);
+		XCloseDisplay(kb->idpy);
+		free(kb->geom.x);
+		free(kb->pressed);
+		free(kb);
+	}
+	if(showstats)
+		printstats(True);
+	if(heat)
+		munmap(heat, sizeof(Heatmap) + nkeys * sizeof(HeatKey));
+	if(steno)
+		munmap(steno, stenosize);
+	free(modkeys);
+}
+
+/* Collects the keys typed after Multi_key and types the keysym of the
+ * sequence they form in composetab. */
+void
+compose(int k, KeySym mod) {
+	const Compose *c;
+	KeyCode code;
+	KeySym sym;
+	Bool shift = mod == XK_Shift_L || mod == XK_Shift_R;
+	int i, j;
+	uint w;
+
+	if(kb->composekey < 0) {
+		memset(kb->composeseq, 0, sizeof(kb->composeseq));
+		kb->ncompose = 0;
+		kb->composekey = k;
+		drawkey(k);
+		return;
+	}
+	/* Multi_key again cancels the sequence */
+	if(keys[k].keysym != XK_Multi_key) {
+		for(j = 0; j < nwords; j++) {
+			w = kb->pressed[j] & modkeys[j];
+			kb->pressed[j] &= ~w;
+			for(; w; w &= w - 1) {
+				i = j * 32 + LOWBIT(w);
+				if(keys[i].keysym == XK_Shift_L
+						|| keys[i].keysym == XK_Shift_R)
+					shift = True;
+				drawkey(i);
+			}
+		}
+		/* the keysym the key types, not the one in the layout */
+		code = XKeysymToKeycode(kb->dpy, keys[k].keysym);
+		sym = code ? XkbKeycodeToKeysym(kb->dpy, code, 0, shift)
+			: NoSymbol;
+		kb->composeseq[kb->ncompose++] = sym ? sym : keys[k].keysym;
+		c = findcompose(kb->composeseq);
+		if(c && !c->result)
+			return; /* wait for the rest of the sequence */
+		if(c)
+			typekeysym(c->result);
+	}
+	k = kb->composekey;
+	kb->composekey = -1;
+	drawkey(k);
 }
 
 void
 configurenotify(XEvent *e) {
 	XConfigureEvent *ev = &e->xconfigure;
-
-	if(ev->window == win && (ev->width != ww || ev->height != wh)) {
-		ww = ev->width;
-		wh = ev->height;
-		XFreePixmap(dpy, dc.drawable);
-		dc.drawable = XCreatePixmap(dpy, root, ww, wh,
-				DefaultDepth(dpy, screen));
+	Window dummy;
+
+	if(ev->window != kb->win)
+		return;
+	/* the preview is placed in root coordinates */
+	if(previewscale)
+		XTranslateCoordinates(kb->dpy, kb->win, kb->root, 0, 0,
+				&kb->wx, &kb->wy, &dummy);
+	if(ev->width != kb->ww || ev->height != kb->wh) {
+		kb->ww = ev->width;
+		kb->wh = ev->height;
+		XFreePixmap(kb->dpy, kb->dc.drawable);
+		kb->dc.drawable = XCreatePixmap(kb->dpy, kb->root,
+				kb->ww, kb->wh,
+				DefaultDepth(kb->dpy, kb->screen));
+		if(previewscale)
+			setpreviewsrc();
+		flushglyphs(); /* of the old cell size */
 		updatekeys();
+		kb->stale = True;
 	}
 }
 
 void
-countrows() {
-	int i = 0;
+countkey(int k, int x, int y) {
+	HeatKey *h;
+
+	if(!heat)
+		return;
+	h = &heat->keys[k];
+	h->hits++;
+	h->grid[(y - kb->geom.y[k]) * HEATROWS / kb->geom.h[k]]
+		[(x - kb->geom.x[k]) * HEATCOLS / kb->geom.w[k]]++;
+	if(keys[k].keysym == XK_BackSpace && kb->lastkey >= 0)
+		heat->keys[kb->lastkey].backspace++;
+	kb->lastkey = k;
+}
 
-	for(i = 0, rows = 1; i < LENGTH(keys); i++) {
-		if(keys[i].keysym == 0)
-			rows++;
+/* seconds of CPU time used so far, by all threads */
+double
+cputime(void) {
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* grows the damaged area, present() puts it on the window */
+void
+damage(const XRectangle *r) {
+	int x, y;
+
+	if(!kb->damaged.width) {
+		kb->damaged = *r;
+		return;
 	}
+	x = MIN(kb->damaged.x, r->x);
+	y = MIN(kb->damaged.y, r->y);
+	kb->damaged.width = MAX(kb->damaged.x + kb->damaged.width,
+			r->x + r->width) - x;
+	kb->damaged.height = MAX(kb->damaged.y + kb->damaged.height,
+			r->y + r->height) - y;
+	kb->damaged.x = x;
+	kb->damaged.y = y;
 }
 
 void
@@ -231,201 +627,775 @@ die(const char *errstr, ...) {
 	exit(EXIT_FAILURE);
 }
 
+void *
+ecalloc(size_t nmemb, size_t size) {
+	void *p;
+
+	if(!(p = calloc(nmemb, size)))
+		die("svkbd: cannot allocate memory\n");
+	return p;
+}
+
 void
 drawkeyboard(void) {
+	struct timespec t0 = { 0, 0 }, t1;
 	int i;
 
-	for(i = 0; i < LENGTH(keys); i++) {
+	kb->stale = False;
+	if(showstats)
+		redraws++;
+	if(kb->panel) {
+		if(showstats)
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+		drawpanel();
+		XSync(kb->dpy, False);
+		if(showstats) {
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			flipns += (t1.tv_sec - t0.tv_sec) * 1000000000L
+				+ t1.tv_nsec - t0.tv_nsec;
+			flips++;
+		}
+		return;
+	}
+	for(i = 0; i < nkeys; i++) {
 		if(keys[i].keysym != 0)
-			drawkey(&keys[i]);
+			drawkey(i);
 	}
-	XSync(dpy, False);
 }
 
 void
-drawkey(Key *k) {
-	int x, y, h, len;
-	XRectangle r = { k->x, k->y, k->w, k->h};
+drawkey(int k) {
+	XRectangle r = { kb->geom.x[k], kb->geom.y[k],
+		kb->geom.w[k], kb->geom.h[k] };
 	const char *l;
 	ulong *col;
 
-	if(k->pressed)
-		col = dc.press;
-	else if(k->highlighted)
-		col = dc.high;
+	/* nothing to see, the next expose repaints everything from keys[] */
+	if(!kb->isvisible) {
+		kb->stale = True;
+		return;
+	}
+	if(kb->panel)
+		return;
+	if(ISSET(kb->pressed, k) || k == kb->composekey
+			|| (kb->steno && keys[k].keysym == XK_SvkbdSteno))
+		col = kb->dc.press;
+	else if(ISSET(kb->highlighted, k))
+		col = kb->dc.high;
 	else
-		col = dc.norm;
+		col = kb->dc.norm;
+	if(keys[k].label) {
+		l = keys[k].label;
+	} else {
+		l = XKeysymToString(keys[k].keysym);
+	}
+	drawbox(kb->dc.drawable, r, l, col);
+	damage(&r);
+}
 
-	XSetForeground(dpy, dc.gc, col[ColBG]);
-	XFillRectangles(dpy, dc.drawable, dc.gc, &r, 1);
-	XSetForeground(dpy, dc.gc, dc.norm[ColFG]);
+/* draws r with a border and l centered in it */
+void
+drawbox(Drawable d, XRectangle r, const char *l, const ulong *col) {
+	int x, y, h, len = strlen(l);
+
+	h = kb->dc.font.ascent + kb->dc.font.descent;
+	y = r.y + (r.height / 2) - (h / 2) + kb->dc.font.ascent;
+	x = r.x + (r.width / 2) - (textnw(l, len) / 2);
+	XSetForeground(kb->dpy, kb->dc.gc, col[ColBG]);
+	XFillRectangles(kb->dpy, d, kb->dc.gc, &r, 1);
+	XSetForeground(kb->dpy, kb->dc.gc, kb->dc.norm[ColFG]);
 	r.height -= 1;
 	r.width -= 1;
-	XDrawRectangles(dpy, dc.drawable, dc.gc, &r, 1);
-	XSetForeground(dpy, dc.gc, col[ColFG]);
-	if(k->label) {
-		l = k->label;
+	XDrawRectangles(kb->dpy, d, kb->dc.gc, &r, 1);
+	XSetForeground(kb->dpy, kb->dc.gc, col[ColFG]);
+	if(kb->dc.font.set) {
+		XmbDrawString(kb->dpy, d, kb->dc.font.set, kb->dc.gc,
+				x, y, l, len);
+	} else {
+		XDrawString(kb->dpy, d, kb->dc.gc, x, y, l, len);
+	}
+}
+
+/* draws panel cell c of the current page, symbols from the glyph cache */
+void
+drawcell(int c, Bool pressed) {
+	XRectangle r;
+	uint n = symbolcols * symbolrows, i = kb->page * n + c;
+	char l[5];
+
+	if(!kb->isvisible) {
+		kb->stale = True;
+		return;
+	}
+	cellrect(c, &r);
+	if(c >= n) {
+		drawbox(kb->dc.drawable, r, symbolcontrols[c - n],
+				pressed ? kb->dc.press : kb->dc.norm);
+	} else if(i >= nsymbols) {
+		drawbox(kb->dc.drawable, r, "", kb->dc.norm);
+	} else if(pressed) {
+		utf8encode(symbolat(i), l);
+		drawbox(kb->dc.drawable, r, l, kb->dc.press);
 	} else {
-		l = XKeysymToString(k->keysym);
-	}
-	len = strlen(l);
-	h = dc.font.ascent + dc.font.descent;
-	y = k->y + (k->h / 2) - (h / 2) + dc.font.ascent;
-	x = k->x + (k->w / 2) - (textnw(l, len) / 2);
-	if(dc.font.set) {
-		XmbDrawString(dpy, dc.drawable, dc.font.set, dc.gc, x, y, l,
-				len);
+		XCopyArea(kb->dpy, getglyph(symbolat(i), r.width, r.height),
+				kb->dc.drawable, kb->dc.gc, 0, 0,
+				r.width, r.height, r.x, r.y);
+	}
+	damage(&r);
+}
+
+/* Lays out and draws only the page shown, so the cost of a page flip
+ * does not depend on how many symbols there are. */
+void
+drawpanel(void) {
+	XRectangle r = { 0, 0, kb->ww, kb->wh };
+	int i;
+
+	if(!kb->isvisible) {
+		kb->stale = True;
+		return;
+	}
+	XSetForeground(kb->dpy, kb->dc.gc, kb->dc.norm[ColBG]);
+	XFillRectangles(kb->dpy, kb->dc.drawable, kb->dc.gc, &r, 1);
+	damage(&r);
+	for(i = 0; i < symbolcols * symbolrows + SymLast; i++)
+		drawcell(i, False);
+}
+
+/* Draws the strips of the progress bar of kb->dwellkey due by now and
+ * presses it once dwelltime has passed. */
+void
+dwell(void) {
+	XRectangle r, s;
+	int n, t = kb->dwellkey;
+
+	if(t < 0 || kb->dwelldrawn < 0)
+		return;
+	n = MIN(msince(&kb->dwellstart) * DWELLSTEPS / MAX(dwelltime, 1),
+			DWELLSTEPS);
+	if(n > kb->dwelldrawn && !kb->isvisible) {
+		kb->stale = True;
+	} else if(n > kb->dwelldrawn) {
+		if(kb->panel) {
+			cellrect(t, &r);
+		} else {
+			r.x = kb->geom.x[t];
+			r.y = kb->geom.y[t];
+			r.width = kb->geom.w[t];
+			r.height = kb->geom.h[t];
+		}
+		/* only the new strips, along the bottom inside the border */
+		s.height = MAX(2, r.height / 8);
+		s.y = r.y + r.height - 1 - s.height;
+		s.x = r.x + 1 + (r.width - 2) * kb->dwelldrawn / DWELLSTEPS;
+		s.width = r.x + 1 + (r.width - 2) * n / DWELLSTEPS - s.x;
+		XSetForeground(kb->dpy, kb->dc.gc, kb->dc.press[ColBG]);
+		XFillRectangles(kb->dpy, kb->dc.drawable, kb->dc.gc, &s, 1);
+		damage(&s);
+	}
+	kb->dwelldrawn = n;
+	if(n < DWELLSTEPS)
+		return;
+	kb->dwelldrawn = -1;
+	if(kb->panel) {
+		cellaction(t);
 	} else {
-		XDrawString(dpy, dc.drawable, dc.gc, x, y, l, len);
+		press(t, 0);
+		unpress(t, 0);
+	}
+}
+
+/* the pointer rests on key or panel cell t now, -1 for none */
+void
+dwellon(int t) {
+	if(t == kb->dwellkey)
+		return;
+	/* wipe the progress bar of the one left */
+	if(kb->dwellkey >= 0 && kb->dwelldrawn > 0) {
+		if(kb->panel)
+			drawcell(kb->dwellkey, False);
+		else
+			drawkey(kb->dwellkey);
 	}
-	XCopyArea(dpy, dc.drawable, win, dc.gc, k->x, k->y, k->w, k->h,
-			k->x, k->y);
+	kb->dwellkey = t;
+	kb->dwelldrawn = 0;
+	clock_gettime(CLOCK_MONOTONIC, &kb->dwellstart);
 }
 
+/* ms until the next progress strip of any display is due, -1 if none */
+int
+dwelltimeout(void) {
+	Kbd *k;
+	long t, min = -1;
+
+	for(k = kbds; k; k = k->next) {
+		if(k->dwellkey < 0 || k->dwelldrawn < 0)
+			continue;
+		t = ((long)dwelltime * (k->dwelldrawn + 1) + DWELLSTEPS - 1)
+			/ DWELLSTEPS - msince(&k->dwellstart);
+		t = MAX(t, 0);
+		if(min < 0 || t < min)
+			min = t;
+	}
+	return min;
+}
+
+/* only called from the event loop, the injector is the only consumer */
+void
+enqueue(Display *dpy, uint keycode, KeySym keysym, Bool press) {
+	uint head = atomic_load_explicit(&injecthead, memory_order_relaxed);
+
+	while(sem_wait(&injectfree) < 0); /* full, wait for the injector */
+	injectq[head % LENGTH(injectq)].dpy = dpy;
+	injectq[head % LENGTH(injectq)].keycode = keycode;
+	injectq[head % LENGTH(injectq)].keysym = keysym;
+	injectq[head % LENGTH(injectq)].press = press;
+	injectq[head % LENGTH(injectq)].pressed = pressedat;
+	atomic_store_explicit(&injecthead, head + 1, memory_order_release);
+	sem_post(&injectsem);
+}
+
+/* Exposed parts of the window are copied from dc.drawable, which keeps
+ * the whole keyboard. Keys are only drawn again if it is stale. */
 void
 expose(XEvent *e) {
 	XExposeEvent *ev = &e->xexpose;
+	XRectangle r = { ev->x, ev->y, ev->width, ev->height };
+
+	if(ev->window != kb->win)
+		return;
+	kb->isvisible = True;
+	if(showstats)
+		exposes++;
+	XUnionRectWithRegion(&r, kb->exposed, kb->exposed);
+	if(ev->count != 0)
+		return;
+	if(kb->stale) {
+		drawkeyboard(); /* all of it is damaged, present() copies it */
+	} else {
+		XSetRegion(kb->dpy, kb->dc.gc, kb->exposed);
+		XCopyArea(kb->dpy, kb->dc.drawable, kb->win, kb->dc.gc,
+				0, 0, kb->ww, kb->wh, 0, 0);
+		XSetClipMask(kb->dpy, kb->dc.gc, None);
+	}
+	XDestroyRegion(kb->exposed);
+	kb->exposed = XCreateRegion();
+}
 
-	if(ev->count == 0 && (ev->window == win))
-		drawkeyboard();
+/* constant time, composetab is a perfect hash table made by mkcompose */
+const Compose *
+findcompose(const uint *seq) {
+	const Compose *c;
+	uint seed;
+
+	seed = composedisp[composehash(seq, 0) % LENGTH(composedisp)];
+	c = &composetab[composehash(seq, seed) % LENGTH(composetab)];
+	return memcmp(c->seq, seq, sizeof(c->seq)) ? NULL : c;
+}
+
+int
+findcell(int x, int y) {
+	XRectangle r;
+	int row;
+
+	/* a window too small for the panel has no cells */
+	cellrect(0, &r);
+	if(!r.width || !r.height || x < 0 || y < 0
+			|| (row = y / r.height) > symbolrows)
+		return -1;
+	if(row < symbolrows)
+		return x / r.width < symbolcols
+			? row * symbolcols + x / r.width : -1;
+	cellrect(symbolcols * symbolrows, &r);
+	return r.width && x / r.width < SymLast
+		? symbolcols * symbolrows + x / r.width : -1;
 }
 
-Key *
+/* Only geometry is looked at, the row separators have no size and never
+ * match. Rows are tested first, most keys are rejected on y and h alone. */
+int
 findkey(int x, int y) {
 	int i;
 
-	for(i = 0; i < LENGTH(keys); i++) {
-		if(keys[i].keysym && x > keys[i].x &&
-				x < keys[i].x + keys[i].w &&
-				y > keys[i].y && y < keys[i].y + keys[i].h) {
-			return &keys[i];
-		}
+	for(i = 0; i < nkeys; i++) {
+		if(y > kb->geom.y[i] && y < kb->geom.y[i] + kb->geom.h[i]
+				&& x > kb->geom.x[i]
+				&& x < kb->geom.x[i] + kb->geom.w[i])
+			return i;
+	}
+	return -1;
+}
+
+/* An open addressing lookup, svkbd-steno leaves half the table empty but
+ * a file without empty slots still stops after nslots probes. Returns
+ * NULL for unknown chords or entries whose text is not in the file. */
+const StenoSlot *
+findsteno(uint64_t chord) {
+	const StenoSlot *e;
+	uint i, n, mask = steno->nslots - 1;
+	size_t texts = stenosize - sizeof(Steno)
+		- steno->nslots * sizeof(StenoSlot);
+
+	if(!chord)
+		return NULL;
+	for(i = stenohash(chord) & mask, n = 0;
+			n < steno->nslots && steno->slots[i].chord;
+			i = (i + 1) & mask, n++) {
+		e = &steno->slots[i];
+		if(e->chord == chord)
+			return (size_t)e->text + e->len <= texts ? e : NULL;
 	}
 	return NULL;
 }
 
+/* the cache keeps cells of one size, it is emptied when that changes */
+void
+flushglyphs(void) {
+	int i;
+
+	for(i = 0; i < symbolcache; i++) {
+		if(kb->glyphs[i].pm != None)
+			XFreePixmap(kb->dpy, kb->glyphs[i].pm);
+		kb->glyphs[i].pm = None;
+		kb->glyphs[i].used = 0;
+	}
+}
+
+void
+genericevent(XEvent *e) {
+#ifdef PRESENT
+	XGenericEvent *ev = &e->xgeneric;
+
+	if(ev->extension == kb->presentopcode
+			&& ev->evtype == PresentCompleteNotify)
+		kb->presentpending = False;
+#endif
+}
+
 ulong
 getcolor(const char *colstr) {
-	Colormap cmap = DefaultColormap(dpy, screen);
+	Colormap cmap = DefaultColormap(kb->dpy, kb->screen);
 	XColor color;
 
-	if(!XAllocNamedColor(dpy, cmap, colstr, &color, &color))
+	if(!XAllocNamedColor(kb->dpy, cmap, colstr, &color, &color))
 		die("error, cannot allocate color '%s'\n", colstr);
 	return color.pixel;
 }
 
+/* Returns the cell showing cp, rendering it into the least recently
+ * used cache entry if it is not there. */
+Pixmap
+getglyph(uint cp, int w, int h) {
+	XRectangle r = { 0, 0, w, h };
+	Cell *g, *lru = NULL;
+	char l[5];
+	int i;
+
+	kb->glyphtick++;
+	for(i = 0; i < symbolcache; i++) {
+		g = &kb->glyphs[i];
+		if(g->pm != None && g->cp == cp) {
+			g->used = kb->glyphtick;
+			return g->pm;
+		}
+		if(!lru || g->used < lru->used)
+			lru = g;
+	}
+	if(lru->pm == None)
+		lru->pm = XCreatePixmap(kb->dpy, kb->root, w, h,
+				DefaultDepth(kb->dpy, kb->screen));
+	utf8encode(cp, l);
+	drawbox(lru->pm, r, l, kb->dc.norm);
+	lru->cp = cp;
+	lru->used = kb->glyphtick;
+	return lru->pm;
+}
+
+void
+hidepreview(void) {
+	if(kb->previewshown) {
+		XUnmapWindow(kb->dpy, kb->preview);
+		kb->previewshown = False;
+	}
+}
+
 void
 initfont(const char *fontstr) {
 	char *def, **missing;
 	int i, n;
 
 	missing = NULL;
-	if(dc.font.set)
-		XFreeFontSet(dpy, dc.font.set);
-	dc.font.set = XCreateFontSet(dpy, fontstr, &missing, &n, &def);
+	if(kb->dc.font.set)
+		XFreeFontSet(kb->dpy, kb->dc.font.set);
+	kb->dc.font.set = XCreateFontSet(kb->dpy, fontstr, &missing, &n, &def);
 	if(missing) {
 		while(n--)
-			fprintf(stderr, "svkbd: missing fontset: %s\n", missing[n]);
+			fprintf(stderr, "svkbd: missing fontset: %s\n",
+					missing[n]);
 		XFreeStringList(missing);
 	}
-	if(dc.font.set) {
+	if(kb->dc.font.set) {
 		XFontStruct **xfonts;
 		char **font_names;
-		dc.font.ascent = dc.font.descent = 0;
-		n = XFontsOfFontSet(dc.font.set, &xfonts, &font_names);
-		for(i = 0, dc.font.ascent = 0, dc.font.descent = 0; i < n; i++) {
-			dc.font.ascent = MAX(dc.font.ascent, (*xfonts)->ascent);
-			dc.font.descent = MAX(dc.font.descent,(*xfonts)->descent);
+		kb->dc.font.ascent = kb->dc.font.descent = 0;
+		n = XFontsOfFontSet(kb->dc.font.set, &xfonts, &font_names);
+		for(i = 0; i < n; i++) {
+			kb->dc.font.ascent = MAX(kb->dc.font.ascent,
+					(*xfonts)->ascent);
+			kb->dc.font.descent = MAX(kb->dc.font.descent,
+					(*xfonts)->descent);
 			xfonts++;
 		}
 	} else {
-		if(dc.font.xfont)
-			XFreeFont(dpy, dc.font.xfont);
-		dc.font.xfont = NULL;
-		if(!(dc.font.xfont = XLoadQueryFont(dpy, fontstr))
-		&& !(dc.font.xfont = XLoadQueryFont(dpy, "fixed")))
+		if(kb->dc.font.xfont)
+			XFreeFont(kb->dpy, kb->dc.font.xfont);
+		kb->dc.font.xfont = NULL;
+		if(!(kb->dc.font.xfont = XLoadQueryFont(kb->dpy, fontstr))
+		&& !(kb->dc.font.xfont = XLoadQueryFont(kb->dpy, "fixed")))
 			die("error, cannot load font: '%s'\n", fontstr);
-		dc.font.ascent = dc.font.xfont->ascent;
-		dc.font.descent = dc.font.xfont->descent;
+		kb->dc.font.ascent = kb->dc.font.xfont->ascent;
+		kb->dc.font.descent = kb->dc.font.xfont->descent;
 	}
-	dc.font.height = dc.font.ascent + dc.font.descent;
+	kb->dc.font.height = kb->dc.font.ascent + kb->dc.font.descent;
 }
 
 void
-leavenotify(XEvent *e) {
-	unpress(NULL, 0);
+initheatmap(const char *path) {
+	struct stat st;
+	size_t size;
+	int fd, i;
+
+	size = sizeof(Heatmap) + nkeys * sizeof(HeatKey);
+	if((fd = open(path, O_RDWR|O_CREAT, 0600)) < 0 || fstat(fd, &st) < 0)
+		die("svkbd: cannot open heatmap '%s'\n", path);
+	if(st.st_size != (off_t)size && ftruncate(fd, 0) < 0)
+		die("svkbd: cannot truncate heatmap '%s'\n", path);
+	if(ftruncate(fd, size) < 0 || (heat = mmap(NULL, size,
+			PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		die("svkbd: cannot map heatmap '%s'\n", path);
+	close(fd);
+
+	/* counters of another layout are of no use, start over */
+	for(i = 0; i < nkeys; i++) {
+		if(heat->keys[i].keysym != keys[i].keysym
+				|| heat->keys[i].width != keys[i].width)
+			break;
+	}
+	if(heat->magic != HEATMAGIC || heat->nkeys != nkeys
+			|| i != nkeys) {
+		memset(heat, 0, size);
+		heat->magic = HEATMAGIC;
+		heat->nkeys = nkeys;
+		for(i = 0; i < nkeys; i++) {
+			heat->keys[i].keysym = keys[i].keysym;
+			heat->keys[i].width = keys[i].width;
+		}
+	}
 }
 
+/* what the display independent code needs to know about keys[] */
 void
-press(Key *k, KeySym mod) {
+initlayout(void) {
 	int i;
-	k->pressed = !k->pressed;
-
-	if(!IsModifierKey(k->keysym)) {
-		for(i = 0; i < LENGTH(keys); i++) {
-			if(keys[i].pressed && IsModifierKey(keys[i].keysym)) {
-				XTestFakeKeyEvent(dpy,
-					XKeysymToKeycode(dpy, keys[i].keysym),
-					True, 0);
-			}
+
+	/* the panel divides by these, and getglyph() needs a cell */
+	if(!symbolcols || !symbolrows || !symbolcache)
+		die("svkbd: symbolcols, symbolrows and symbolcache "
+				"must not be 0\n");
+	for(i = 0; i < LENGTH(symbols); i++)
+		nsymbols += symbols[i].last - symbols[i].first + 1;
+	npages = (nsymbols + symbolcols * symbolrows - 1)
+		/ (symbolcols * symbolrows);
+	nwords = BITWORDS(nkeys);
+	modkeys = ecalloc(nwords, sizeof(uint));
+	for(i = 0, rows = 1; i < nkeys; i++) {
+		if(keys[i].keysym == 0)
+			rows++;
+		else if(IsModifierKey(keys[i].keysym))
+			SETBIT(modkeys, i);
+	}
+}
+
+void
+initpreview(void) {
+	XSetWindowAttributes wa;
+
+	wa.override_redirect = True;
+	wa.background_pixmap = None;
+	wa.border_pixel = kb->dc.norm[ColFG];
+	kb->preview = XCreateWindow(kb->dpy, kb->root, 0, 0, 1, 1, 1,
+			CopyFromParent, CopyFromParent, CopyFromParent,
+			CWOverrideRedirect | CWBackPixmap | CWBorderPixel, &wa);
+	kb->previewdst = XRenderCreatePicture(kb->dpy, kb->preview,
+			XRenderFindVisualFormat(kb->dpy,
+				DefaultVisual(kb->dpy, kb->screen)), 0, NULL);
+	setpreviewsrc();
+}
+
+void
+initsteno(const char *path) {
+	struct stat st;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+		die("svkbd: cannot open steno dictionary '%s'\n", path);
+	stenosize = st.st_size;
+	if(stenosize < sizeof(Steno) || (steno = mmap(NULL, stenosize,
+			PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		die("svkbd: cannot map steno dictionary '%s'\n", path);
+	close(fd);
+	if(steno->magic != STENOMAGIC || !steno->nslots
+			|| steno->nslots & (steno->nslots - 1)
+			|| (stenosize - sizeof(Steno)) / sizeof(StenoSlot)
+			< steno->nslots)
+		die("svkbd: '%s' is not a steno dictionary\n", path);
+}
+
+void
+inject(KeySym keysym, Bool press) {
+	enqueue(kb->idpy, XKeysymToKeycode(kb->dpy, keysym), 0, press);
+}
+
+/* Sends the queued key events in order on each display's own
+ * connection, so they never wait for rendering in the event loop. */
+void *
+injector(void *arg) {
+	Inject *in;
+	KeySym syms[2];
+	struct timespec first = { 0, 0 }, now;
+	uint tail;
+
+	for(tail = 0;; tail++) {
+		while(sem_wait(&injectsem) < 0);
+		in = &injectq[tail % LENGTH(injectq)];
+		if(!in->dpy)
+			break;
+		if(in->keysym) {
+			/* at both levels, a lone letter would be typed as
+			 * its lowercase */
+			syms[0] = syms[1] = in->keysym;
+			XChangeKeyboardMapping(in->dpy, in->keycode, 2,
+					syms, 1);
+			XSync(in->dpy, False);
 		}
-		pressedmod = mod;
-		if(pressedmod) {
-			XTestFakeKeyEvent(dpy, XKeysymToKeycode(dpy, mod),
-					True, 0);
+		if(in->pressed.tv_sec && !first.tv_sec)
+			first = in->pressed;
+		XTestFakeKeyEvent(in->dpy, in->keycode, in->press, 0);
+		if(tail + 1 == atomic_load_explicit(&injecthead,
+					memory_order_acquire)
+				|| injectq[(tail + 1) % LENGTH(injectq)].dpy
+				!= in->dpy) {
+			XFlush(in->dpy);
+			/* -s: from the ButtonPress to its events leaving */
+			if(first.tv_sec) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				atomic_fetch_add(&injectns,
+						(now.tv_sec - first.tv_sec)
+						* 1000000000L + now.tv_nsec
+						- first.tv_nsec);
+				atomic_fetch_add(&injections, 1);
+				first.tv_sec = 0;
+			}
 		}
-		XTestFakeKeyEvent(dpy, XKeysymToKeycode(dpy, k->keysym), True, 0);
+		sem_post(&injectfree);
+	}
+	return NULL;
+}
 
-		for(i = 0; i < LENGTH(keys); i++) {
-			if(keys[i].pressed && IsModifierKey(keys[i].keysym)) {
-				XTestFakeKeyEvent(dpy,
-					XKeysymToKeycode(dpy, keys[i].keysym),
-					False, 0);
-			}
+void
+initinjector(void) {
+	sem_init(&injectsem, 0, 0);
+	sem_init(&injectfree, 0, LENGTH(injectq));
+	if(pthread_create(&injectthread, NULL, injector, NULL))
+		die("svkbd: cannot start injector thread\n");
+}
+
+void
+leavenotify(XEvent *e) {
+	if(dwelltime)
+		dwellon(-1);
+	if(!kb->chording)
+		unpress(-1, 0);
+}
+
+void
+mappingnotify(XEvent *e) {
+	XRefreshKeyboardMapping(&e->xmapping);
+}
+
+long
+msince(const struct timespec *t) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000
+		+ (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+void
+panelpress(int x, int y) {
+	if((kb->panelcell = findcell(x, y)) >= 0)
+		drawcell(kb->panelcell, True);
+}
+
+/* a cell acts when it is released, sliding off it cancels */
+void
+panelrelease(int x, int y) {
+	int c = kb->panelcell;
+
+	kb->panelcell = -1;
+	if(c < 0)
+		return;
+	if(findcell(x, y) != c)
+		drawcell(c, False);
+	else
+		cellaction(c);
+}
+
+void
+printstats(Bool force) {
+	time_t now = time(NULL);
+	double cpu;
+	ulong n, ns;
+
+	if(!force && now - statsince < 60)
+		return;
+	cpu = cputime();
+	fprintf(stderr, "svkbd: %lu wakeups, %lu frames in %lds, "
+			"%.1f wakeups per minute\n", wakeups, frames,
+			(long)(now - statsince), now > statsince
+			? wakeups * 60.0 / (now - statsince) : 0.0);
+	fprintf(stderr, "svkbd: %.3fs CPU time, %.3f%% of the time\n",
+			cpu - statcpu, now > statsince
+			? (cpu - statcpu) * 100.0 / (now - statsince) : 0.0);
+	n = atomic_exchange(&injections, 0);
+	ns = atomic_exchange(&injectns, 0);
+	if(n)
+		fprintf(stderr, "svkbd: %lu presses, %.1fus from press to "
+				"injection\n", n, ns / 1000.0 / n);
+	if(previews)
+		fprintf(stderr, "svkbd: %lu previews, %.1fus queueing each\n",
+				previews, previewns / 1000.0 / previews);
+	if(flips)
+		fprintf(stderr, "svkbd: %lu symbol pages, %.1fus each\n",
+				flips, flipns / 1000.0 / flips);
+	if(exposes)
+		fprintf(stderr, "svkbd: %lu exposes, %lu full redraws\n",
+				exposes, redraws);
+	wakeups = frames = previews = previewns = flips = flipns = 0;
+	exposes = redraws = 0;
+	statsince = now;
+	statcpu = cpu;
+}
+
+void
+present(void) {
+	if(!kb->damaged.width)
+		return;
+#ifdef PRESENT
+	/* at most one frame per vblank, the rest waits in dc.drawable */
+	if(kb->presentopcode) {
+		if(kb->presentpending)
+			return;
+		XFixesSetRegion(kb->dpy, kb->presentregion, &kb->damaged, 1);
+		XPresentPixmap(kb->dpy, kb->win, kb->dc.drawable,
+				++kb->presentserial, None,
+				kb->presentregion, 0, 0, None, None, None,
+				PresentOptionCopy, 0, 1, 0, NULL, 0);
+		kb->presentpending = True;
+		kb->damaged.width = 0;
+		frames++;
+		return;
+	}
+#endif
+	XCopyArea(kb->dpy, kb->dc.drawable, kb->win, kb->dc.gc,
+			kb->damaged.x, kb->damaged.y, kb->damaged.width,
+			kb->damaged.height, kb->damaged.x, kb->damaged.y);
+	kb->damaged.width = 0;
+	frames++;
+}
+
+void
+press(int k, KeySym mod) {
+	int j;
+	uint w;
+
+	if(keys[k].keysym == XK_SvkbdSymbols) {
+		kb->panel = True;
+		kb->panelcell = -1;
+		kb->dwellkey = -1; /* was a key, not a cell */
+		drawkeyboard();
+		return;
+	}
+	if(keys[k].keysym == XK_SvkbdSteno) {
+		kb->steno = steno && !kb->steno;
+		drawkey(k);
+		return;
+	}
+	if(!ISSET(modkeys, k) && (keys[k].keysym == XK_Multi_key
+				|| kb->composekey >= 0)) {
+		compose(k, mod);
+		return;
+	}
+	if(ISSET(kb->pressed, k))
+		CLRBIT(kb->pressed, k);
+	else
+		SETBIT(kb->pressed, k);
+
+	if(!ISSET(modkeys, k)) {
+		for(j = 0; j < nwords; j++) {
+			for(w = kb->pressed[j] & modkeys[j]; w; w &= w - 1)
+				inject(keys[j * 32 + LOWBIT(w)].keysym, True);
+		}
+		kb->pressedmod = mod;
+		if(kb->pressedmod)
+			inject(mod, True);
+		inject(keys[k].keysym, True);
+
+		for(j = 0; j < nwords; j++) {
+			for(w = kb->pressed[j] & modkeys[j]; w; w &= w - 1)
+				inject(keys[j * 32 + LOWBIT(w)].keysym, False);
 		}
 	}
 	drawkey(k);
 }
 
 void
-unpress(Key *k, KeySym mod) {
-	int i;
+unpress(int k, KeySym mod) {
+	int i, j;
+	uint w;
 
-	if(k != NULL) {
-		switch(k->keysym) {
+	if(k >= 0) {
+		switch(keys[k].keysym) {
 		case XK_Cancel:
-			exit(0);
+			/* release the keys, then leave through cleanup() */
+			running = False;
+			break;
 		default:
 			break;
 		}
 	}
 
-	for(i = 0; i < LENGTH(keys); i++) {
-		if(keys[i].pressed && !IsModifierKey(keys[i].keysym)) {
-			XTestFakeKeyEvent(dpy,
-				XKeysymToKeycode(dpy, keys[i].keysym),
-				False, 0);
-			keys[i].pressed = 0;
-			drawkey(&keys[i]);
-			break;
-		}
-	}
-	if(i != LENGTH(keys)) {
-		if(pressedmod) {
-			XTestFakeKeyEvent(dpy,
-				XKeysymToKeycode(dpy, pressedmod),
-				False, 0);
-		}
-		pressedmod = 0;
-
-		for(i = 0; i < LENGTH(keys); i++) {
-			if(keys[i].pressed) {
-				XTestFakeKeyEvent(dpy,
-					XKeysymToKeycode(dpy,
-						keys[i].keysym), False, 0);
-				keys[i].pressed = 0;
-				drawkey(&keys[i]);
-			}
+	/* the first pressed key that is no modifier */
+	for(j = 0; j < nwords && !(kb->pressed[j] & ~modkeys[j]); j++);
+	if(j == nwords)
+		return;
+	i = j * 32 + LOWBIT(kb->pressed[j] & ~modkeys[j]);
+	inject(keys[i].keysym, False);
+	CLRBIT(kb->pressed, i);
+	drawkey(i);
+
+	if(kb->pressedmod)
+		inject(kb->pressedmod, False);
+	kb->pressedmod = 0;
+
+	for(j = 0; j < nwords; j++) {
+		w = kb->pressed[j];
+		kb->pressed[j] = 0;
+		for(; w; w &= w - 1) {
+			i = j * 32 + LOWBIT(w);
+			inject(keys[i].keysym, False);
+			drawkey(i);
 		}
 	}
 }
@@ -433,14 +1403,87 @@ unpress(Key *k, KeySym mod) {
 void
 run(void) {
 	XEvent ev;
+	struct pollfd *pfd = NULL;
+	Kbd **k;
+	int i, n = 0;
 
-	/* main event loop */
-	XSync(dpy, False);
+	for(kb = kbds; kb; kb = kb->next)
+		XSync(kb->dpy, False);
+
+	/* main event loop, over all displays */
+	statsince = time(NULL);
+	statcpu = cputime();
 	while(running) {
-		XNextEvent(dpy, &ev);
-		if(handler[ev.type])
-			(handler[ev.type])(&ev); /* call handler */
+		/* Keyboards whose display went away are dropped, the others
+		 * go on. They stay allocated and connected: the injector may
+		 * still hold events for them and Xlib may report errors on
+		 * their connections again. */
+		for(k = &kbds; *k;) {
+			if(atomic_load(&(*k)->dead)) {
+				*k = (*k)->next;
+				n = 0;
+			} else {
+				k = &(*k)->next;
+			}
+		}
+		if(!kbds)
+			die("svkbd: lost all displays\n");
+		if(!n) {
+			for(kb = kbds; kb; kb = kb->next, n++);
+			free(pfd);
+			pfd = ecalloc(n, sizeof(struct pollfd));
+			for(i = 0, kb = kbds; kb; kb = kb->next, i++) {
+				pfd[i].fd = ConnectionNumber(kb->dpy);
+				pfd[i].events = POLLIN;
+			}
+		}
+		for(kb = kbds; kb && running; kb = kb->next) {
+			while(running && !atomic_load(&kb->dead)
+					&& XPending(kb->dpy)) {
+				XNextEvent(kb->dpy, &ev);
+				if(handler[ev.type])
+					(handler[ev.type])(&ev);
+			}
+			if(atomic_load(&kb->dead))
+				continue;
+			if(dwelltime)
+				dwell();
+			/* all events so far are handled, show their result */
+			present();
+			XFlush(kb->dpy);
+		}
+		/* flushing may have queued more events */
+		for(kb = kbds; kb; kb = kb->next) {
+			if(atomic_load(&kb->dead) || XEventsQueued(kb->dpy,
+						QueuedAlready))
+				break;
+		}
+		if(kb || !running)
+			continue;
+		if(showstats)
+			wakeups++;
+		/* no timeout unless a dwell progresses */
+		if(poll(pfd, n, dwelltime ? dwelltimeout() : -1) < 0
+				&& errno != EINTR)
+			die("svkbd: poll failed\n");
+		if(showstats)
+			printstats(False);
 	}
+	free(pfd);
+}
+
+/* resident memory in bytes, -1 if unknown */
+long
+rss(void) {
+	FILE *f;
+	long size, res = -1;
+
+	if((f = fopen("/proc/self/statm", "r"))) {
+		if(fscanf(f, "%ld %ld", &size, &res) != 2)
+			res = -1;
+		fclose(f);
+	}
+	return res < 0 ? -1 : res * sysconf(_SC_PAGESIZE);
 }
 
 void
@@ -450,63 +1493,90 @@ setup(void) {
 	XSizeHints *sizeh = NULL;
 	XClassHint *ch;
 	Atom atype = -1;
-	int i, sh, sw;
+	KeySym *syms;
+	int i, j, n, min, max, sh, sw;
 	XWMHints *wmh;
 
 	/* init screen */
-	screen = DefaultScreen(dpy);
-	root = RootWindow(dpy, screen);
-	sw = DisplayWidth(dpy, screen);
-	sh = DisplayHeight(dpy, screen);
+	kb->screen = DefaultScreen(kb->dpy);
+	kb->root = RootWindow(kb->dpy, kb->screen);
+	sw = DisplayWidth(kb->dpy, kb->screen);
+	sh = DisplayHeight(kb->dpy, kb->screen);
 	initfont(font);
 
 	/* init atoms */
 	if(isdock) {
-		netatom[NetWMWindowType] = XInternAtom(dpy,
+		kb->netatom[NetWMWindowType] = XInternAtom(kb->dpy,
 				"_NET_WM_WINDOW_TYPE", False);
-		atype = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
+		atype = XInternAtom(kb->dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
 	}
 
 	/* init appearance */
-	countrows();
-	if(!ww)
-		ww = sw;
-	if(!wh)
-		wh = sh * rows / 32;
-
-	if(!wx)
-		wx = 0;
-	if(wx < 0)
-		wx = sw + wx - ww;
-	if(!wy)
-		wy = sh - wh;
-	if(wy < 0)
-		wy = sh + wy - wh;
-
-	dc.norm[ColBG] = getcolor(normbgcolor);
-	dc.norm[ColFG] = getcolor(normfgcolor);
-	dc.press[ColBG] = getcolor(pressbgcolor);
-	dc.press[ColFG] = getcolor(pressfgcolor);
-	dc.high[ColBG] = getcolor(highlightbgcolor);
-	dc.high[ColFG] = getcolor(highlightfgcolor);
-	dc.drawable = XCreatePixmap(dpy, root, ww, wh,
-			DefaultDepth(dpy, screen));
-	dc.gc = XCreateGC(dpy, root, 0, 0);
-	if(!dc.font.set)
-		XSetFont(dpy, dc.gc, dc.font.xfont->fid);
-	for(i = 0; i < LENGTH(keys); i++)
-		keys[i].pressed = 0;
+	kb->ww = gw;
+	kb->wh = gh;
+	kb->wx = gx;
+	kb->wy = gy;
+	kb->lastkey = -1;
+	if(!kb->ww)
+		kb->ww = sw;
+	if(!kb->wh)
+		kb->wh = sh * rows / 32;
+
+	if(!kb->wx)
+		kb->wx = 0;
+	if(kb->wx < 0)
+		kb->wx = sw + kb->wx - kb->ww;
+	if(!kb->wy)
+		kb->wy = sh - kb->wh;
+	if(kb->wy < 0)
+		kb->wy = sh + kb->wy - kb->wh;
+
+	kb->dc.norm[ColBG] = getcolor(normbgcolor);
+	kb->dc.norm[ColFG] = getcolor(normfgcolor);
+	kb->dc.press[ColBG] = getcolor(pressbgcolor);
+	kb->dc.press[ColFG] = getcolor(pressfgcolor);
+	kb->dc.high[ColBG] = getcolor(highlightbgcolor);
+	kb->dc.high[ColFG] = getcolor(highlightfgcolor);
+	kb->dc.drawable = XCreatePixmap(kb->dpy, kb->root, kb->ww, kb->wh,
+			DefaultDepth(kb->dpy, kb->screen));
+	kb->dc.gc = XCreateGC(kb->dpy, kb->root, 0, 0);
+	if(!kb->dc.font.set)
+		XSetFont(kb->dpy, kb->dc.gc, kb->dc.font.xfont->fid);
+	kb->geom.x = ecalloc(4 * nkeys, sizeof(int));
+	kb->geom.y = kb->geom.x + nkeys;
+	kb->geom.w = kb->geom.y + nkeys;
+	kb->geom.h = kb->geom.w + nkeys;
+	kb->pressed = ecalloc(2 * nwords, sizeof(uint));
+	kb->highlighted = kb->pressed + nwords;
+	kb->composekey = -1;
+	kb->dwellkey = -1;
+	kb->glyphs = ecalloc(symbolcache, sizeof(Cell));
+	kb->exposed = XCreateRegion();
+	kb->stale = True;
+
+	/* the highest keycode without keysyms is free for typekeysym() */
+	XDisplayKeycodes(kb->dpy, &min, &max);
+	syms = XGetKeyboardMapping(kb->dpy, min, max - min + 1, &n);
+	for(i = max; i >= min && !kb->sparecode; i--) {
+		for(j = 0; j < n && syms[(i - min) * n + j] == NoSymbol; j++);
+		if(j == n)
+			kb->sparecode = i;
+	}
+	XFree(syms);
 
 	wa.override_redirect = !wmborder;
-	wa.border_pixel = dc.norm[ColFG];
-	wa.background_pixel = dc.norm[ColBG];
-	win = XCreateWindow(dpy, root, wx, wy, ww, wh, 0,
+	wa.border_pixel = kb->dc.norm[ColFG];
+	wa.background_pixel = kb->dc.norm[ColBG];
+	kb->win = XCreateWindow(kb->dpy, kb->root, kb->wx, kb->wy,
+			    kb->ww, kb->wh, 0,
 			    CopyFromParent, CopyFromParent, CopyFromParent,
 			    CWOverrideRedirect | CWBorderPixel |
 			    CWBackingPixel, &wa);
-	XSelectInput(dpy, win, StructureNotifyMask|ButtonReleaseMask|
+	XSelectInput(kb->dpy, kb->win, StructureNotifyMask|ButtonReleaseMask|
 			ButtonPressMask|ExposureMask|LeaveWindowMask|
-			PointerMotionMask);
+			VisibilityChangeMask|(hoverhighlight || dwelltime
+			? PointerMotionMask
+			: ButtonMotionMask|PointerMotionHintMask));
 
 	wmh = XAllocWMHints();
 	wmh->input = False;
@@ -514,15 +1584,15 @@ setup(void) {
 	if(!isdock) {
 		sizeh = XAllocSizeHints();
 		sizeh->flags = PMaxSize | PMinSize;
-		sizeh->min_width = sizeh->max_width = ww;
-		sizeh->min_height = sizeh->max_height = wh;
+		sizeh->min_width = sizeh->max_width = kb->ww;
+		sizeh->min_height = sizeh->max_height = kb->wh;
 	}
 	XStringListToTextProperty(&name, 1, &str);
 	ch = XAllocClassHint();
 	ch->res_class = name;
 	ch->res_name = name;
 
-	XSetWMProperties(dpy, win, &str, &str, NULL, 0, sizeh, wmh,
+	XSetWMProperties(kb->dpy, kb->win, &str, &str, NULL, 0, sizeh, wmh,
 			ch);
 
 	XFree(ch);
@@ -532,25 +1602,147 @@ setup(void) {
 		XFree(sizeh);
 
 	if(isdock) {
-		XChangeProperty(dpy, win, netatom[NetWMWindowType], XA_ATOM,
+		XChangeProperty(kb->dpy, kb->win,
+				kb->netatom[NetWMWindowType], XA_ATOM,
 				32, PropModeReplace,
 				(unsigned char *)&atype, 1);
 	}
 
-	XMapRaised(dpy, win);
+#ifdef PRESENT
+	if(XPresentQueryExtension(kb->dpy, &kb->presentopcode, &i, &i)) {
+		XPresentSelectInput(kb->dpy, kb->win,
+				PresentCompleteNotifyMask);
+		kb->presentregion = XFixesCreateRegion(kb->dpy, NULL, 0);
+	} else {
+		kb->presentopcode = 0;
+	}
+#endif
+
+	if(previewscale)
+		initpreview();
+
+	XMapRaised(kb->dpy, kb->win);
 	updatekeys();
 	drawkeyboard();
 }
 
+/* the preview shows dc.drawable scaled up by previewscale */
+void
+setpreviewsrc(void) {
+	XTransform t = {{
+		{ XDoubleToFixed(1), 0, 0 },
+		{ 0, XDoubleToFixed(1), 0 },
+		{ 0, 0, XDoubleToFixed(previewscale) }
+	}};
+
+	if(kb->previewsrc != None)
+		XRenderFreePicture(kb->dpy, kb->previewsrc);
+	kb->previewsrc = XRenderCreatePicture(kb->dpy, kb->dc.drawable,
+			XRenderFindVisualFormat(kb->dpy,
+				DefaultVisual(kb->dpy, kb->screen)), 0, NULL);
+	XRenderSetPictureTransform(kb->dpy, kb->previewsrc, &t);
+	XRenderSetPictureFilter(kb->dpy, kb->previewsrc, FilterBilinear,
+			NULL, 0);
+}
+
+/* Only moves and maps the window created in initpreview() and copies
+ * the key already rendered in dc.drawable, nothing is allocated. */
+void
+showpreview(int k) {
+	struct timespec t0 = { 0, 0 }, t1;
+	int x, y, w, h;
+
+	if(!previewscale || !kb->isvisible || kb->panel)
+		return;
+	if(showstats)
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+	x = kb->geom.x[k];
+	y = kb->geom.y[k];
+	w = kb->geom.w[k] * previewscale;
+	h = kb->geom.h[k] * previewscale;
+	XMoveResizeWindow(kb->dpy, kb->preview,
+			kb->wx + x + (kb->geom.w[k] - w) / 2,
+			MAX(0, kb->wy + y - h), w, h);
+	XMapRaised(kb->dpy, kb->preview);
+	XRenderComposite(kb->dpy, PictOpSrc, kb->previewsrc, None,
+			kb->previewdst, x * previewscale, y * previewscale,
+			0, 0, 0, 0, w, h);
+	kb->previewshown = True;
+	if(showstats) {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		previewns += (t1.tv_sec - t0.tv_sec) * 1000000000L
+			+ t1.tv_nsec - t0.tv_nsec;
+		previews++;
+	}
+}
+
+/* types keysym, on the spare keycode if no key has it unshifted */
+void
+typekeysym(KeySym keysym) {
+	KeyCode code = XKeysymToKeycode(kb->dpy, keysym);
+
+	/* the spare keycode may still be bound to an earlier keysym */
+	if(code && code != kb->sparecode
+			&& XkbKeycodeToKeysym(kb->dpy, code, 0, 0) == keysym) {
+		enqueue(kb->idpy, code, 0, True);
+		enqueue(kb->idpy, code, 0, False);
+	} else if(kb->sparecode) {
+		enqueue(kb->idpy, kb->sparecode, keysym, True);
+		enqueue(kb->idpy, kb->sparecode, 0, False);
+	}
+}
+
+/* index i of all symbols in the ranges of config.h, i < nsymbols */
+uint
+symbolat(uint i) {
+	int r;
+
+	for(r = 0; i > symbols[r].last - symbols[r].first; r++)
+		i -= symbols[r].last - symbols[r].first + 1;
+	return symbols[r].first + i;
+}
+
+/* types the UTF-8 string s of len bytes, in one batch for the injector */
+void
+typestring(const char *s, uint len) {
+	const unsigned char *u = (const unsigned char *)s;
+	uint i, j, n, cp;
+
+	for(i = 0; i < len; i += n) {
+		if(u[i] < 0x80)
+			cp = u[i], n = 1;
+		else if((u[i] & 0xe0) == 0xc0)
+			cp = u[i] & 0x1f, n = 2;
+		else if((u[i] & 0xf0) == 0xe0)
+			cp = u[i] & 0x0f, n = 3;
+		else if((u[i] & 0xf8) == 0xf0)
+			cp = u[i] & 0x07, n = 4;
+		else
+			cp = 0, n = 1; /* not a first byte, skipped */
+		if(i + n > len)
+			break;
+		for(j = 1; j < n; j++)
+			cp = cp << 6 | (u[i + j] & 0x3f);
+		if(cp >= 0x20)
+			typekeysym(cp < 0x100 ? cp : 0x01000000 | cp);
+	}
+}
+
 int
 textnw(const char *text, uint len) {
 	XRectangle r;
 
-	if(dc.font.set) {
-		XmbTextExtents(dc.font.set, text, len, NULL, &r);
+	if(kb->dc.font.set) {
+		XmbTextExtents(kb->dc.font.set, text, len, NULL, &r);
 		return r.width;
 	}
-	return XTextWidth(dc.font.xfont, text, len);
+	return XTextWidth(kb->dc.font.xfont, text, len);
+}
+
+void
+unmapnotify(XEvent *e) {
+	if(e->xunmap.window == kb->win)
+		kb->isvisible = False;
 }
 
 void
@@ -558,33 +1750,86 @@ updatekeys() {
 	int i, j;
 	int x = 0, y = 0, h, base, r = rows;
 
-	h = (wh - 1) / rows;
-	for(i = 0; i < LENGTH(keys); i++, r--) {
-		for(j = i, base = 0; j < LENGTH(keys) && keys[j].keysym != 0; j++)
+	h = (kb->wh - 1) / rows;
+	for(i = 0; i < nkeys; i++, r--) {
+		for(j = i, base = 0; j < nkeys && keys[j].keysym != 0; j++)
 			base += keys[j].width;
-		for(x = 0; i < LENGTH(keys) && keys[i].keysym != 0; i++) {
-			keys[i].x = x;
-			keys[i].y = y;
-			keys[i].w = keys[i].width * (ww - 1) / base;
-			keys[i].h = r == 1 ? wh - y - 1 : h;
-			x += keys[i].w;
+		for(x = 0; i < nkeys && keys[i].keysym != 0; i++) {
+			kb->geom.x[i] = x;
+			kb->geom.y[i] = y;
+			kb->geom.w[i] = keys[i].width * (kb->ww - 1) / base;
+			kb->geom.h[i] = r == 1 ? kb->wh - y - 1 : h;
+			x += kb->geom.w[i];
 		}
 		if(base != 0)
-			keys[i - 1].w = ww - 1 - keys[i - 1].x;
+			kb->geom.w[i - 1] = kb->ww - 1 - kb->geom.x[i - 1];
 		y += h;
 	}
 }
 
+/* writes cp as a 0 terminated UTF-8 string to s, 5 bytes at most */
+int
+utf8encode(uint cp, char *s) {
+	int n;
+
+	if(cp < 0x80) {
+		s[0] = cp;
+		n = 1;
+	} else if(cp < 0x800) {
+		s[0] = 0xc0 | cp >> 6;
+		s[1] = 0x80 | (cp & 0x3f);
+		n = 2;
+	} else if(cp < 0x10000) {
+		s[0] = 0xe0 | cp >> 12;
+		s[1] = 0x80 | (cp >> 6 & 0x3f);
+		s[2] = 0x80 | (cp & 0x3f);
+		n = 3;
+	} else {
+		s[0] = 0xf0 | cp >> 18;
+		s[1] = 0x80 | (cp >> 12 & 0x3f);
+		s[2] = 0x80 | (cp >> 6 & 0x3f);
+		s[3] = 0x80 | (cp & 0x3f);
+		n = 4;
+	}
+	s[n] = '\0';
+	return n;
+}
+
+void
+visibilitynotify(XEvent *e) {
+	XVisibilityEvent *ev = &e->xvisibility;
+
+	if(ev->window == kb->win)
+		kb->isvisible = ev->state != VisibilityFullyObscured;
+}
+
+/* Replaces Xlib's exit on a lost connection, so one X server going away
+ * does not take the keyboards of the others with it. Also called on
+ * the injector thread, run() drops the keyboard. */
+void
+xioerror(Display *dpy, void *arg) {
+	Kbd *k = arg;
+
+	if(!atomic_exchange(&k->dead, True))
+		fprintf(stderr, "svkbd: lost display %s\n", DisplayString(dpy));
+}
+
 void
 usage(char *argv0) {
-	fprintf(stderr, "usage: %s [-hdv] [-g geometry]\n", argv0);
+	fprintf(stderr, "usage: %s [-hdsv] [-g geometry] [-H heatmap]\n"
+			"\t[-S steno] [-display display]...\n", argv0);
 	exit(1);
 }
 
 int
 main(int argc, char *argv[]) {
-	int i, xr, yr, bitm;
+	int i, n = 0, xr, yr, bitm;
 	unsigned int wr, hr;
+	char **displays;
+	Kbd **tail = &kbds;
+	long mem;
+
+	displays = ecalloc(argc, sizeof(char *));
 
 	for (i = 1; argv[i]; i++) {
 		if(!strcmp(argv[i], "-v")) {
@@ -599,31 +1844,70 @@ main(int argc, char *argv[]) {
 
 			bitm = XParseGeometry(argv[i+1], &xr, &yr, &wr, &hr);
 			if(bitm & XValue)
-				wx = xr;
+				gx = xr;
 			if(bitm & YValue)
-				wy = yr;
+				gy = yr;
 			if(bitm & WidthValue)
-				ww = (int)wr;
+				gw = (int)wr;
 			if(bitm & HeightValue)
-				wh = (int)hr;
-			if(bitm & XNegative && wx == 0)
-				wx = -1;
-			if(bitm & YNegative && wy == 0)
-				wy = -1;
+				gh = (int)hr;
+			if(bitm & XNegative && gx == 0)
+				gx = -1;
+			if(bitm & YNegative && gy == 0)
+				gy = -1;
 			i++;
+		} else if(!strcmp(argv[i], "-display")) {
+			if(i >= argc - 1)
+				continue;
+			displays[n++] = argv[++i];
+		} else if(!strcmp(argv[i], "-s")) {
+			showstats = True;
+			continue;
+		} else if(!strcmp(argv[i], "-H")) {
+			if(i >= argc - 1)
+				continue;
+			heatfile = argv[++i];
+		} else if(!strcmp(argv[i], "-S")) {
+			if(i >= argc - 1)
+				continue;
+			stenofile = argv[++i];
 		} else if(!strcmp(argv[i], "-h")) {
 			usage(argv[0]);
 		}
 	}
 
+	XInitThreads();
 	if(!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fprintf(stderr, "warning: no locale support\n");
-	if(!(dpy = XOpenDisplay(0)))
-		die("svkbd: cannot open display\n");
-	setup();
+	initlayout();
+	if(heatfile)
+		initheatmap(heatfile);
+	if(stenofile)
+		initsteno(stenofile);
+	/* the layout and config are shared, everything else is per display */
+	if(n == 0)
+		n = 1; /* displays[0] is NULL, the default display */
+	for(i = 0; i < n; i++) {
+		mem = rss();
+		kb = *tail = ecalloc(1, sizeof(Kbd));
+		tail = &kb->next;
+		if(!(kb->dpy = XOpenDisplay(displays[i])))
+			die("svkbd: cannot open display %s\n",
+					XDisplayName(displays[i]));
+		if(!(kb->idpy = XOpenDisplay(DisplayString(kb->dpy))))
+			die("svkbd: cannot open display %s\n",
+					DisplayString(kb->dpy));
+		XSetIOErrorExitHandler(kb->dpy, xioerror, kb);
+		XSetIOErrorExitHandler(kb->idpy, xioerror, kb);
+		setup();
+		if(showstats && mem >= 0)
+			fprintf(stderr, "svkbd: display %s uses %ldkB\n",
+					DisplayString(kb->dpy),
+					(rss() - mem) / 1024);
+	}
+	free(displays);
+	initinjector();
 	run();
 	cleanup();
-	XCloseDisplay(dpy);
 	return 0;
 }
-
@@ -0,0 +1,30 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * What svkbd.c shares with the layout objects, which layout.c builds from
+ * one layout.*.h each. Needs <X11/Xlib.h> and <X11/keysym.h>.
+ */
+#define LENGTH(x)       (sizeof x / sizeof x[0])
+
+/* keysyms svkbd handles itself, from the vendor specific range */
+#define XK_SvkbdSymbols 0x1005f001 /* opens the symbol panel */
+#define XK_SvkbdSteno   0x1005f002 /* toggles chorded steno input */
+
+typedef unsigned int uint;
+
+typedef struct {
+	const char *label;
+	KeySym keysym;
+	uint width;
+} Key; /* the layout, never written to */
+
+typedef struct {
+	KeySym mod;
+	uint button;
+} Buttonmod;
+
+/* defined by the layout object svkbd is linked with */
+extern const Key keys[];
+extern const uint nkeys;
+extern const Buttonmod buttonmods[];
+extern const uint nbuttonmods;
+extern const Bool norepeat; /* release keys right after pressing them */
@@ -0,0 +1,200 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * injectorder feeds random key events for two displays through enqueue()
+ * and the injector thread, with the X calls replaced by a sink that
+ * checks they arrive in order, that the spare keycode is bound at both
+ * levels and synced before it is pressed and that a display is flushed
+ * before the injector moves on to the other one.  Some syncs are slow so
+ * the ring fills up and enqueue() has to wait.
+ *
+ * Then typestring() types mixed-case text on a small fake keymap and the
+ * keysyms the sink's presses stand for must spell that text again.
+ */
+#define main svkbdmain
+#define XChangeKeyboardMapping sinkmapping
+#define XFlush sinkflush
+#define XKeysymToKeycode sinkkeycode
+#define XkbKeycodeToKeysym sinkkeysym
+#define XSync sinksync
+#define XTestFakeKeyEvent sinkkey
+#include "../svkbd.c"
+#undef main
+
+#define NEVENTS         (1 << 19)
+#define SPARE           250
+#define LETTERS         10 /* keycodes of a to z, A to Z on level 1 */
+#define SPACE           65
+
+static Inject expected[NEVENTS];
+static char displays[2];
+static uint next = 0, syncs = 0;
+static int dirty = -1; /* display with unflushed events */
+static KeySym bound[2];
+static Bool synced[2];
+static Bool typing = False; /* no expected[], record what is typed */
+static KeySym typed[64];
+static uint ntyped = 0;
+
+/* "Hello Wörld ÀΣ", capitals of the panel's ranges included */
+static const char text[] = "Hello W\xc3\xb6rld \xc3\x80\xce\xa3";
+static const KeySym textsyms[] = {
+	XK_H, XK_e, XK_l, XK_l, XK_o, XK_space,
+	XK_W, XK_odiaeresis, XK_r, XK_l, XK_d, XK_space,
+	XK_Agrave, 0x010003a3 /* U+03A3 GREEK CAPITAL LETTER SIGMA */
+};
+
+static int
+dpyno(Display *dpy) {
+	return (char *)dpy - displays;
+}
+
+/* all sink calls for a display must come before the flush that lets
+ * the injector go on with the other one */
+static void
+check(Display *dpy) {
+	if(typing)
+		return;
+	if(next == NEVENTS || expected[next].dpy != dpy)
+		die("injectorder: event %u on the wrong display\n", next);
+	if(dirty >= 0 && dirty != dpyno(dpy))
+		die("injectorder: event %u before display %d was flushed\n",
+				next, dirty);
+}
+
+KeyCode
+sinkkeycode(Display *dpy, KeySym keysym) {
+	if(keysym >= XK_a && keysym <= XK_z)
+		return LETTERS + keysym - XK_a;
+	if(keysym >= XK_A && keysym <= XK_Z)
+		return LETTERS + keysym - XK_A;
+	if(keysym == XK_space)
+		return SPACE;
+	return 0;
+}
+
+KeySym
+sinkkeysym(Display *dpy, KeyCode keycode, int group, int level) {
+	if(keycode >= LETTERS && keycode < LETTERS + 26)
+		return (level ? XK_A : XK_a) + keycode - LETTERS;
+	if(keycode == SPACE)
+		return XK_space;
+	return keycode == SPARE ? bound[dpyno(dpy)] : NoSymbol;
+}
+
+int
+sinkmapping(Display *dpy, int first, int per, KeySym *syms, int n) {
+	KeySym lower, upper;
+
+	if(typing) {
+		/* a lone letter stands for its lowercase on level 0 */
+		XConvertCase(syms[0], &lower, &upper);
+		bound[dpyno(dpy)] = per < 2 || syms[1] == NoSymbol
+			? lower : syms[0];
+		synced[dpyno(dpy)] = False;
+		return 1;
+	}
+	check(dpy);
+	if(first != SPARE || n != 1)
+		die("injectorder: event %u rebinds the wrong key\n", next);
+	/* both levels, or the core rules make a lone letter lowercase */
+	if(per != 2 || syms[0] != expected[next].keysym
+			|| syms[1] != syms[0])
+		die("injectorder: event %u binds the wrong keysyms\n", next);
+	bound[dpyno(dpy)] = *syms;
+	synced[dpyno(dpy)] = False;
+	dirty = dpyno(dpy);
+	return 1;
+}
+
+int
+sinksync(Display *dpy, Bool discard) {
+	struct timespec slow = { 0, 2000000 };
+
+	synced[dpyno(dpy)] = True;
+	dirty = -1;
+	if(++syncs % 1024 == 0)
+		nanosleep(&slow, NULL);
+	return 1;
+}
+
+int
+sinkkey(Display *dpy, uint keycode, Bool press, ulong delay) {
+	Inject *e;
+
+	if(typing) {
+		if(keycode == SPARE && !synced[dpyno(dpy)])
+			die("injectorder: typed on an unsynced spare\n");
+		if(press && ntyped < LENGTH(typed))
+			typed[ntyped++] = sinkkeysym(dpy, keycode, 0, 0);
+		return 1;
+	}
+	check(dpy);
+	e = &expected[next++];
+	if(keycode != e->keycode || press != e->press)
+		die("injectorder: event %u out of order\n", next - 1);
+	if(e->keysym && (!synced[dpyno(dpy)]
+			|| bound[dpyno(dpy)] != e->keysym))
+		die("injectorder: event %u presses an unsynced spare\n",
+				next - 1);
+	dirty = dpyno(dpy);
+	return 1;
+}
+
+int
+sinkflush(Display *dpy) {
+	if(dirty == dpyno(dpy))
+		dirty = -1;
+	return 1;
+}
+
+int
+main(void) {
+	Inject *e;
+	uint i, full = 0;
+	int nfree;
+
+	srand(1);
+	initinjector();
+	for(i = 0; i < NEVENTS; i++) {
+		e = &expected[i];
+		e->dpy = (Display *)&displays[rand() % 4 == 0];
+		e->press = rand() & 1;
+		if(rand() % 8 == 0) {
+			e->keycode = SPARE;
+			e->keysym = !e->press ? 0 : (rand() & 1 ? XK_a : XK_A)
+				+ rand() % 26;
+		} else {
+			e->keycode = 8 + rand() % 240;
+		}
+		if(!sem_getvalue(&injectfree, &nfree) && nfree == 0)
+			full++;
+		enqueue(e->dpy, e->keycode, e->keysym, e->press);
+	}
+	enqueue(NULL, 0, 0, False);
+	pthread_join(injectthread, NULL);
+	if(next != NEVENTS || dirty >= 0)
+		die("injectorder: %u of %u events sent\n", next, NEVENTS);
+	printf("injectorder: %u events in order, ring full %u times\n",
+			NEVENTS, full);
+
+	typing = True;
+	bound[0] = NoSymbol;
+	kb = kbds = ecalloc(1, sizeof(Kbd));
+	kb->dpy = kb->idpy = (Display *)&displays[0];
+	kb->sparecode = SPARE;
+	atomic_store(&injecthead, 0);
+	initinjector();
+	typestring(text, sizeof text - 1);
+	enqueue(NULL, 0, 0, False);
+	pthread_join(injectthread, NULL);
+	if(ntyped != LENGTH(textsyms))
+		die("injectorder: %u of %u characters typed\n", ntyped,
+				(uint)LENGTH(textsyms));
+	for(i = 0; i < ntyped; i++) {
+		if(typed[i] != textsyms[i])
+			die("injectorder: character %u typed as %lx, not %lx\n",
+					i, typed[i], textsyms[i]);
+	}
+	printf("injectorder: \"%s\" typed as is\n", text);
+	return 0;
+}